@@ -3,6 +3,7 @@
 // Source for AVR2
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <inttypes.h>
 
 #include "convert.h"
@@ -10,6 +11,9 @@
 #include "sdcard.h"
 #include "fat32.h"
 #include "lcd.h"
+#include "xfer.h"
+#include "prof.h"
+#include "iostat.h"
 
 int main(void)
 {
@@ -21,10 +25,11 @@ int main(void)
 	uint8_t bufb[512];
 	
 	init_serial();
+	prof_init();
 
 	lcd_init();
 	
-	lcd_printf("Hello World! \n n: %d", 152);
+	lcd_printf_P(PSTR("Hello World! \n n: %d"), 152);
 
 	// init card
 	send_str("\ninit mmc card: ");
@@ -89,10 +94,48 @@ int main(void)
 						send_char('\n');
 					}
 					break;
+
+				case 'x' :
+					// host/xfer takes over until it quits or goes quiet
+					xfer_run(bufb);
+					break;
+
+				case 'b' :
+					send_str("baud (hundreds): ");
+					i = receive_int();
+					// the answer comes at the new rate
+					if (xfer_baud(i)) send_str("unsupported\n");
+					else send_str("ok\n");
+					break;
+				
+#if PROF
+				case 'P' :
+					prof_report(send_str);
+					break;
+
+				case 'Z' :
+					prof_reset();
+					break;
+#endif
+#if IOSTAT
+				case 'I' :
+					iostat_report(send_str);
+					break;
+
+				case 'O' :
+					iostat_reset();
+					break;
+#endif
 				
 				case 'h' :
 				default :
-					send_str("h - help\nl - dir listing\nc - change dir\nd - delete file\np - print file contents\nt - create empty file\ns - dump sector\n");
+					send_str("h - help\nl - dir listing\nc - change dir\nd - delete file\np - print file contents\nt - create empty file\ns - dump sector\nx - file transfer\nb - set baud\n");
+#if PROF
+					send_str("P - profile report\nZ - zero the profile\n");
+#endif
+#if IOSTAT
+					send_str("I - sd card I/O counters\nO - zero them\n");
+#endif
 					break;
 			
 			}
@@ -81,7 +81,7 @@ int main(void)
 void init_serial(void)
 {
 	UBRR0H = 0;
-	UBRR0L = 51; // 19.2k BAUD FOR 8MHZ SYSTEM CLOCK
+	UBRR0L = 51; // 9600 BAUD FOR 8MHZ SYSTEM CLOCK
 	UCSR0C = (1<<USBS0)|(3<<UCSZ00);  // 8 BIT NO PARITY 2 STOP
 	UCSR0B = (1<<RXEN0)|(1<<TXEN0); // ENABLE TX AND RX ALSO 8 BIT
 }
@@ -1,8 +1,15 @@
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <string.h>
 #include "camera.h"
 #include "lcd.h"
 #include "fat32.h"
-#include "camera.h"
+#include "exif.h"
+#include "gps.h"
+#include "sched.h"
+#include "prof.h"
+#include "iostat.h"
+#include "trace.h"
 
 #define F_CPU 8E6
 #include <util/delay.h>
@@ -18,161 +25,680 @@
 #define CAMERA_DATA 0x0a
 #define CAMERA_SLEEP 0x09
 
-// jpg file end marker
-unsigned char CAMERA_JPGENDMARKER[] = {0xff, 0xd9};
+#define CAMERA_SETBAUD 0x07
+
+// largest data packet we have RAM for (two of them), the camera goes to 512
+#ifndef CAMERA_PKGMAX
+#define CAMERA_PKGMAX 256
+#endif
+#define CAMERA_PKGMIN 64	// the camera's default
+
+#define CAMERA_RETRIES 8		// requests for one packet before giving up on the photo
+#define CAMERA_PKT_TIMEOUT 500	// ms
 
-// interrupt populated circular buffer
+// interrupt populated circular buffer for command replies, power of two
+// so the indices wrap with a mask, one slot stays empty to tell full from empty
+#define CAMERA_RING 64
+#define CAMERA_RINGMASK (CAMERA_RING - 1)
 #define CAMERA_DATAREADY() (camera_readpos != camera_writepos)
-#define CAMERA_READBYTE() (camera_buf[camera_readpos++])
+#define CAMERA_READBYTE() camera_readbyte()
 volatile unsigned char camera_readpos, camera_writepos;
-volatile unsigned char camera_buf[130];
+volatile unsigned char camera_buf[CAMERA_RING];
+volatile unsigned char camera_overruns;		// bytes dropped because nobody was reading
+volatile unsigned char camera_rxcount;		// bytes received, to tell when the line goes quiet
 
-// camera initialization routine
-void camera_init(void)
+static inline unsigned char camera_readbyte(void)
+{
+	unsigned char c = camera_buf[camera_readpos];
+	camera_readpos = (camera_readpos + 1) & CAMERA_RINGMASK;
+	return c;
+}
+
+// during a download the interrupt fills these two packet buffers in turn,
+// so one can be written to the card while the next one arrives
+enum {CAMERA_PKT_EMPTY, CAMERA_PKT_OK, CAMERA_PKT_BAD};
+volatile unsigned char camera_pkt[2][CAMERA_PKGMAX];
+volatile unsigned char camera_pktready[2];
+volatile unsigned char camera_pktfill;
+volatile unsigned char camera_pktsum;
+volatile unsigned int camera_pktpos, camera_pktlen;
+volatile char camera_pktmode;
+
+// the link settings picked at init, packet length includes the 6 byte header and verify code
+static unsigned int camera_pkglen = CAMERA_PKGMIN;
+
+// session state, synced and configured once then kept warm between photos
+enum {CAMERA_OFF, CAMERA_READY, CAMERA_STANDBY, CAMERA_ASLEEP};
+static char camera_state = CAMERA_OFF;
+static unsigned int camera_baud = 144;	// hundreds
+static char camera_tuned;
+
+// JPEG resolution wanted for the next photo and the one the camera has
+static unsigned char camera_res = CAMERA_RES_640;
+static unsigned char camera_res_sent;
+
+// faster rates, U2X divisors for 8 MHz and the camera's own divider byte
+struct camera_rate {
+	unsigned int baud;	// hundreds
+	uint8_t ubrr;
+	uint8_t div;
+};
+
+static const struct camera_rate camera_rates[] PROGMEM = {
+	{576, 16, 0x1f}, {384, 25, 0x2f}, {288, 34, 0x3f}, {192, 51, 0x5f}
+};
+
+// the camera finds our baud itself while syncing, this is where we start
+static void camera_baseline(void)
 {
+	UCSR1A &= ~(1<<U2X1);
 	UBRR1H = 0;
 	UBRR1L = 34; // BAUD FOR 8MHZ SYSTEM CLOCK (34 is a solid value)
-	UCSR1C = (3<<UCSZ10);  // 8 BIT NO PARITY 1 STOP
-	UCSR1B = (1<<RXCIE1)|(1<<RXEN1)|(1<<TXEN1); // ENABLE TX AND RX ALSO 8 BIT and INTERRUPT
+	camera_baud = 144;
+}
 
-	// setup interrupts
-	sei();
+// what the link waits for, timed on sched_now() so camera_photo_step()
+// can return in between: a reply, the answers to a SYNC, or just time
+enum {CAMERA_IO_WAIT, CAMERA_IO_REPLY, CAMERA_IO_SYNC, CAMERA_IO_SYNCED, CAMERA_IO_SETTLE};
+#define CAMERA_IO_BUSY 0xff
+static unsigned char camera_io, camera_io_type, camera_io_cmd, camera_tries;
+static uint16_t camera_t, camera_ms;	// sched_now() the wait began and how long it may take
+static unsigned char camera_reply[6];
 
-	// initialization sequence
-	unsigned char cmdbuf[6];
-	camera_readpos = 0;
-	camera_writepos = 0;
-	
-	lcd_printf("camera: syncing\n");
-
-	int i = 61;
-	do {
-		camera_snd_cmd(CAMERA_SYNC, 0, 0, 0, 0);
-		_delay_ms(50);
-	} while (!camera_response() && --i);
-
-	// no response
-	if (!i) {
-		lcd_printf("camera error:\ninit timeout");
-		while (1) ;
-		return;
+static void camera_wait(unsigned char io, unsigned int ms)
+{
+	camera_io = io;
+	camera_t = sched_now();
+	camera_ms = ms;
+}
+
+// the next reply within ms, its type and for an ACK the command it's for
+static void camera_expect(unsigned char type, unsigned char cmd, unsigned int ms)
+{
+	camera_io_type = type;
+	camera_io_cmd = cmd;
+	camera_wait(CAMERA_IO_REPLY, ms);
+}
+
+// sends a command, its ACK is expected within ms
+static void camera_ask(char cmd, char b3, char b4, char b5, char b6, unsigned int ms)
+{
+	camera_readpos = camera_writepos;
+	camera_snd_cmd(cmd, b3, b4, b5, b6);
+	camera_expect(CAMERA_ACK, cmd, ms);
+}
+
+// SYNC every 50 ms until the camera answers or tries run out
+static void camera_sync(unsigned char tries)
+{
+	camera_readpos = camera_writepos;
+	camera_tries = tries;
+	camera_snd_cmd(CAMERA_SYNC, 0, 0, 0, 0);
+	camera_wait(CAMERA_IO_SYNC, 50);
+}
+
+// how the wait ended: 0 done, 1 timed out, 2 garbled answer, or CAMERA_IO_BUSY
+static unsigned char camera_io_poll(void)
+{
+	unsigned char i, late = (uint16_t)(sched_now() - camera_t) >= camera_ms;
+
+	if (camera_io == CAMERA_IO_WAIT) return late ? 0 : CAMERA_IO_BUSY;
+	if (camera_io == CAMERA_IO_SETTLE) {
+		if (!late) return CAMERA_IO_BUSY;
+		// drop answers to any extra SYNCs
+		camera_readpos = camera_writepos;
+		return 0;
+	}
+
+	if (!camera_response()) {
+		if (!late) return CAMERA_IO_BUSY;
+		if (camera_io == CAMERA_IO_SYNC && --camera_tries) {
+			camera_snd_cmd(CAMERA_SYNC, 0, 0, 0, 0);
+			camera_t = sched_now();
+			return CAMERA_IO_BUSY;
+		}
+		return camera_io == CAMERA_IO_SYNC ? 1 : 2;
+	}
+
+	for (i=0; i<6; i++) camera_reply[i] = CAMERA_READBYTE();
+	if (camera_reply[0] != 0xaa) return camera_io == CAMERA_IO_REPLY ? 1 : 2;
+
+	switch (camera_io) {
+	case CAMERA_IO_SYNC:
+		// its ACK, the camera's own SYNC follows
+		if (camera_reply[1] != CAMERA_ACK) return 2;
+		camera_wait(CAMERA_IO_SYNCED, 50);
+		return CAMERA_IO_BUSY;
+	case CAMERA_IO_SYNCED:
+		// send back ack
+		if (camera_reply[1] != CAMERA_SYNC) return 2;
+		camera_snd_cmd(CAMERA_ACK, CAMERA_SYNC, 0, 0, 0);
+		camera_wait(CAMERA_IO_SETTLE, 10);
+		return CAMERA_IO_BUSY;
+	}
+
+	return camera_reply[1] != camera_io_type || (camera_io_type == CAMERA_ACK && camera_reply[2] != camera_io_cmd);
+}
+
+// where getting the camera ready and a photo out of it is, each step
+// starts a wait and camera_next() takes it on once the wait is over
+enum {
+	CAMERA_DO_IDLE,
+	CAMERA_DO_WAKE,		// pick the cheapest way to get ready
+	CAMERA_DO_STANDBY,	// SYNC from standby
+	CAMERA_DO_ASLEEP,	// SYNC from sleep
+	CAMERA_DO_READY,	// settings current, on to the photo
+	CAMERA_DO_START,	// full session start
+	CAMERA_DO_TUNED,	// SYNC at the rate it was left at
+	CAMERA_DO_BASELINE,	// SYNC at the power on rate
+	CAMERA_DO_RATE,		// next faster rate to try
+	CAMERA_DO_SETBAUD,	// its ACK
+	CAMERA_DO_NEWBAUD,	// UART switched, settling
+	CAMERA_DO_CHECK,	// round trips at the new rate
+	CAMERA_DO_BACK,		// told to go back down, settling
+	CAMERA_DO_BACKSYNC,	// SYNC back at the power on rate
+	CAMERA_DO_TUNE_END,	// done with the rates
+	CAMERA_DO_RESYNC,	// SYNC to stay at the power on rate
+	CAMERA_DO_INITIAL,	// picture settings ACK
+	CAMERA_DO_PKGSIZE,	// package size ACK
+	CAMERA_DO_SNAPSHOT,	// SNAPSHOT ACK
+	CAMERA_DO_GETPIC,	// snapshot settling
+	CAMERA_DO_PICACK,	// GETPIC ACK
+	CAMERA_DO_PICSIZE,	// DATA with the size
+	CAMERA_DO_PACKET,	// downloading
+	CAMERA_DO_QUIET		// a bad packet, waiting for the line to go quiet
+};
+static unsigned char camera_do;
+static unsigned char camera_rate_i;	// camera_rates[] being tried
+static char camera_tune;		// setup finds the package size, round trips left while a rate is checked
+static char camera_err;		// why the camera didn't start, for camera_init()
+
+// the photo asked for, moved along by camera_photo_step(), no name is a wake only
+static char camera_fname[13];		// an 8.3 name
+static unsigned int camera_packets, camera_pkt_i, camera_load_bar;
+static unsigned char camera_retries, camera_quiet_n;
+static struct fatwrite_t * camera_fw;
+static struct gps_location camera_gl;	// the fix may move on before packet 0
+static char camera_geotag, camera_bar;
+
+static char camera_then(unsigned char step)
+{
+	camera_do = step;
+	return CAMERA_BUSY;
+}
+
+// picture settings and package size, tune finds the largest package size again
+static char camera_setup(char tune)
+{
+	camera_tune = tune;
+	camera_res_sent = 0;
+	camera_ask(CAMERA_INITIAL, 0, 0x07, 0x03, camera_res, 100); // JPEG
+	return camera_then(CAMERA_DO_INITIAL);
+}
+
+static void camera_ask_pkgsize(void)
+{
+	camera_ask(CAMERA_PKGSIZE, 0x08, camera_pkglen & 0xff, camera_pkglen >> 8, 0x00, 100);
+}
+
+// the camera didn't start, r is the camera_sync() error
+static char camera_fail(char r)
+{
+	camera_err = r;
+	camera_state = CAMERA_OFF;
+	camera_do = CAMERA_DO_IDLE;
+	return CAMERA_FAILED;
+}
+
+// gives up on a photo, the next one starts from scratch
+static char camera_lost(void)
+{
+	camera_pktmode = 0;
+	camera_state = CAMERA_OFF;
+	camera_do = CAMERA_DO_IDLE;
+	lcd_printf_P(PSTR("camera error:\npacket"));
+	return CAMERA_FAILED;
+}
+
+// the snapshot is in, opens the file and starts the download
+static char camera_open(void)
+{
+	uint32_t psize;
+	PROF_SCOPE(PROF_PHOTO_OPEN);
+	IOSTAT_SCOPE(IOSTAT_PHOTO);
+
+	psize = camera_reply[3] | (((uint32_t)camera_reply[4])<<8) | (((uint32_t)camera_reply[5])<<16);
+	camera_packets = (psize + camera_pkglen - 7) / (camera_pkglen - 6);
+	camera_load_bar = camera_packets/16;
+	if (!camera_load_bar) camera_load_bar = 1;
+
+	// create file
+	del(camera_fname);
+	touch(camera_fname);
+	write_start(camera_fname, camera_fw);
+
+	if (camera_bar) {
+		lcd_printf_P(PSTR("Saving: %dkB\n"), (unsigned int)(psize/1024));
+		lcd_go_line(1);
+	}
+
+	// hand the packets to the interrupt and ask for the first
+	camera_pktready[0] = camera_pktready[1] = CAMERA_PKT_EMPTY;
+	camera_pktfill = 0;
+	camera_pktpos = 0;
+	camera_pktmode = 1;
+	camera_pkt_i = 0;
+	camera_retries = 0;
+	camera_snd_cmd(CAMERA_ACK, 0, 0, 0, 0);
+	camera_t = sched_now();
+
+	return camera_then(CAMERA_DO_PACKET);
+}
+
+// takes the plan on once a wait ended with r, returns CAMERA_BUSY while
+// there is a new one, CAMERA_SAVED when a wake only is done
+static char camera_next(unsigned char r)
+{
+	struct camera_rate rt;
+
+	while (1) switch (camera_do) {
+	case CAMERA_DO_WAKE:
+		// still configured and awake, one round trip proves the link
+		if (camera_state == CAMERA_STANDBY) {
+			camera_sync(2);
+			return camera_then(CAMERA_DO_STANDBY);
+		}
+		// asleep keeps the baud, but not necessarily the picture settings
+		if (camera_state == CAMERA_ASLEEP) {
+			camera_sync(8);
+			return camera_then(CAMERA_DO_ASLEEP);
+		}
+		camera_do = camera_state == CAMERA_READY ? CAMERA_DO_READY : CAMERA_DO_START;
+		break;
+
+	case CAMERA_DO_STANDBY:
+		camera_do = r ? CAMERA_DO_START : CAMERA_DO_READY;
+		break;
+
+	case CAMERA_DO_ASLEEP:
+		if (!r) return camera_setup(0);
+		camera_do = CAMERA_DO_START;
+		break;
+
+	case CAMERA_DO_READY:
+		camera_state = CAMERA_READY;
+		// a new resolution only needs the settings sent again
+		if (camera_res != camera_res_sent) return camera_setup(0);
+		if (!camera_fname[0]) {
+			camera_do = CAMERA_DO_IDLE;
+			return CAMERA_SAVED;
+		}
+		// take photo
+		camera_ask(CAMERA_SNAPSHOT, 0, 0, 0, 0, 1000);
+		return camera_then(CAMERA_DO_SNAPSHOT);
+
+	case CAMERA_DO_START:
+		UCSR1C = (3<<UCSZ10);  // 8 BIT NO PARITY 1 STOP
+		UCSR1B = (1<<RXCIE1)|(1<<RXEN1)|(1<<TXEN1); // ENABLE TX AND RX ALSO 8 BIT and INTERRUPT
+
+		// setup interrupts
+		sei();
+
+		// initialization sequence
+		camera_readpos = 0;
+		camera_writepos = 0;
+		camera_pktmode = 0;
+		camera_state = CAMERA_OFF;
+
+		lcd_printf_P(PSTR("camera: syncing\n"));
+
+		// the camera keeps a rate we switched it to, so try that first
+		if (camera_tuned) {
+			camera_sync(8);
+			return camera_then(CAMERA_DO_TUNED);
+		}
+		r = 1;
+		// fall through
+	case CAMERA_DO_TUNED:
+		if (!r) return camera_setup(1);
+		camera_baseline();
+		camera_sync(61);
+		return camera_then(CAMERA_DO_BASELINE);
+
+	case CAMERA_DO_BASELINE:
+		if (r) return camera_fail(r);
+		camera_rate_i = 0;
+		camera_do = CAMERA_DO_RATE;
+		break;
+
+	// steps the link up to the fastest rate that survives a few round trips
+	case CAMERA_DO_RATE:
+		if (camera_rate_i == sizeof(camera_rates)/sizeof(camera_rates[0])) {
+			// back where we started
+			camera_baseline();
+			camera_do = CAMERA_DO_TUNE_END;
+			break;
+		}
+		memcpy_P(&rt, &camera_rates[camera_rate_i], sizeof(rt));
+		// the ACK comes back at the old rate, after our command is out
+		camera_ask(CAMERA_SETBAUD, rt.div, 0x01, 0, 0, 100);
+		return camera_then(CAMERA_DO_SETBAUD);
+
+	case CAMERA_DO_SETBAUD:
+		if (r) {
+			camera_rate_i++;
+			camera_do = CAMERA_DO_RATE;
+			break;
+		}
+		memcpy_P(&rt, &camera_rates[camera_rate_i], sizeof(rt));
+		UBRR1H = 0;
+		UBRR1L = rt.ubrr;
+		UCSR1A |= (1<<U2X1);
+		camera_wait(CAMERA_IO_WAIT, 10);
+		camera_tune = 3;
+		return camera_then(CAMERA_DO_NEWBAUD);
+
+	case CAMERA_DO_CHECK:
+		if (!r && !--camera_tune) {
+			memcpy_P(&rt, &camera_rates[camera_rate_i], sizeof(rt));
+			camera_baud = rt.baud;
+			camera_do = CAMERA_DO_TUNE_END;
+			break;
+		}
+		if (r) {
+			// not clean, tell the camera to go back down and try the next rate
+			camera_snd_cmd(CAMERA_SETBAUD, 0x7f, 0x01, 0, 0);
+			camera_wait(CAMERA_IO_WAIT, 10);
+			return camera_then(CAMERA_DO_BACK);
+		}
+		// fall through
+	case CAMERA_DO_NEWBAUD:
+		camera_sync(4);
+		return camera_then(CAMERA_DO_CHECK);
+
+	case CAMERA_DO_BACK:
+		camera_baseline();
+		camera_sync(8);
+		return camera_then(CAMERA_DO_BACKSYNC);
+
+	case CAMERA_DO_BACKSYNC:
+		if (!r) camera_rate_i++;
+		camera_do = r ? CAMERA_DO_TUNE_END : CAMERA_DO_RATE;
+		break;
+
+	case CAMERA_DO_TUNE_END:
+		camera_tuned = 1;
+		if (camera_baud == 144) {
+			camera_sync(61);
+			return camera_then(CAMERA_DO_RESYNC);
+		}
+		r = 0;
+		// fall through
+	case CAMERA_DO_RESYNC:
+		if (r) return camera_fail(r);
+		return camera_setup(1);
+
+	case CAMERA_DO_INITIAL:
+		// a new session can't go on without its settings, a warm one starts over
+		if (r && camera_tune) return camera_fail(2);
+		if (r) {
+			camera_do = CAMERA_DO_START;
+			break;
+		}
+		camera_res_sent = camera_res;
+		// largest package size the camera accepts that fits our buffers
+		if (camera_tune) camera_pkglen = CAMERA_PKGMAX;
+		camera_ask_pkgsize();
+		return camera_then(CAMERA_DO_PKGSIZE);
+
+	case CAMERA_DO_PKGSIZE:
+		if (r && camera_tune && (camera_pkglen >>= 1) > CAMERA_PKGMIN) {
+			camera_ask_pkgsize();
+			return camera_then(CAMERA_DO_PKGSIZE);
+		}
+		if (r && !camera_tune) {
+			camera_do = CAMERA_DO_START;
+			break;
+		}
+		if (camera_tune) lcd_printf_P(PSTR("camera: %d00 baud\n%d byte packets"), camera_baud, camera_pkglen);
+		camera_do = CAMERA_DO_READY;
+		break;
+
+	case CAMERA_DO_SNAPSHOT:
+		if (r) return camera_lost();
+		camera_wait(CAMERA_IO_WAIT, 50);
+		return camera_then(CAMERA_DO_GETPIC);
+
+	case CAMERA_DO_GETPIC:
+		// get snapshot and size
+		camera_ask(CAMERA_GETPIC, 0x01, 0, 0, 0, 1000);
+		return camera_then(CAMERA_DO_PICACK);
+
+	case CAMERA_DO_PICACK:
+		if (r) return camera_lost();
+		camera_expect(CAMERA_DATA, 0, 1000);
+		return camera_then(CAMERA_DO_PICSIZE);
+
+	case CAMERA_DO_PICSIZE:
+		if (r) return camera_lost();
+		return camera_open();
+
+	default:
+		return CAMERA_FAILED;
 	}
-	
-	
-	// get ack and sync, send back ack
-	camera_rcv_cmd(cmdbuf);
-	camera_rcv_cmd(cmdbuf);
+}
+
+// starts the plan, the first camera_photo_step() takes it on
+static void camera_begin(unsigned char step)
+{
+	camera_do = step;
+	camera_wait(CAMERA_IO_WAIT, 0);
+}
+
+// steps the plan through for callers that can wait
+static char camera_finish(void)
+{
+	char r;
+
+	while ((r = camera_photo_step()) == CAMERA_BUSY)
+		_delay_us(100);
+	return r;
+}
 
-	if (cmdbuf[1] != CAMERA_SYNC) {
-		lcd_printf("camera error:\nmissing sync");
+// camera initialization routine
+void camera_init(void)
+{
+	camera_fname[0] = '\0';
+	camera_begin(CAMERA_DO_START);
+	if (camera_finish() == CAMERA_SAVED) return;
+
+	if (camera_err == 1) {
+		lcd_printf_P(PSTR("camera error:\ninit timeout"));
 		while (1) ;
-		return;
 	} else {
-		//lcd_printf("camera: synced!\n");
+		lcd_printf_P(PSTR("camera error:\nmissing sync"));
+		while (1) ;
 	}
+}
 
-	camera_snd_cmd(CAMERA_ACK, CAMERA_SYNC, 0, 0, 0);
-	
-	// set picture settings
-	//lcd_printf("camera: set");
-	camera_snd_cmd(CAMERA_INITIAL, 0, 0x07, 0x03, 0x07); // JPEG, 640 x 480
-	camera_rcv_cmd(cmdbuf);
+char camera_wake(void)
+{
+	camera_fname[0] = '\0';
+	camera_begin(CAMERA_DO_WAKE);
+	return camera_finish() == CAMERA_SAVED ? 0 : 1;
+}
 
-	//lcd_printf("camera: pkgsize");
-	camera_snd_cmd(CAMERA_PKGSIZE, 0x08, 0x80, 0x00, 0x00); // pkg size 128 bytes
-	camera_rcv_cmd(cmdbuf);
+void camera_resolution(unsigned char res)
+{
+	camera_res = res;
+}
+
+void camera_standby(void)
+{
+	if (camera_state == CAMERA_READY) camera_state = CAMERA_STANDBY;
 }
 
 void camera_sleep(void)
 {
 	camera_snd_cmd(CAMERA_SLEEP, 0, 0, 0, 0);
+	if (camera_state != CAMERA_OFF) camera_state = CAMERA_ASLEEP;
 }
 
-// takes a photo and saves it as fname in the current directory
-void camera_takephoto(const char * fname, struct fatwrite_t * fwrite)
+// points the interrupt at buffer b for a fresh packet
+static void camera_pktrestart(unsigned char b)
 {
-	unsigned char cmdbuf[6];
-	uint32_t psize;
-	unsigned int packets = 0, load_bar = 0;
+	cli();
+	camera_pktready[b] = CAMERA_PKT_EMPTY;
+	camera_pktfill = b;
+	camera_pktpos = 0;
+	sei();
+}
 
-		
-	lcd_printf("camera: photo");
-	
-	// clear buffer
-	camera_readpos = camera_writepos;
+void camera_photo_start(const char * fname, const struct gps_location * gl, struct fatwrite_t * fwrite)
+{
+	strncpy(camera_fname, fname, sizeof(camera_fname) - 1);
+	camera_fw = fwrite;
+	camera_geotag = gl != 0;
+	if (gl) camera_gl = *gl;
+	camera_packets = camera_pkt_i = 0;
+	camera_begin(CAMERA_DO_WAKE);
+}
 
-	// take photo
-	camera_snd_cmd(CAMERA_SNAPSHOT, 0, 0, 0, 0);
-	camera_rcv_cmd(cmdbuf);
-	_delay_ms(50);
+// stops the download and closes the file, complete or not
+static char camera_photo_end(void)
+{
+	camera_pktmode = 0;
+	camera_do = CAMERA_DO_IDLE;
+	camera_snd_cmd(CAMERA_ACK, 0, 0, 0xf0, 0xf0);
+	write_end(camera_fw);
 
-	// get snapshot and size
-	camera_snd_cmd(CAMERA_GETPIC, 0x01, 0, 0, 0);
-	camera_rcv_cmd(cmdbuf);
-	camera_rcv_cmd(cmdbuf);
+	if (camera_pkt_i < camera_packets) return camera_lost();
 
-	psize = cmdbuf[3] | (((uint32_t)cmdbuf[4])<<8) | (((uint32_t)cmdbuf[5])<<16);
-	packets = psize/(128-6);// + (psize%(128-6) ? 1 : 0);
-	load_bar = packets/16;
-	
-	// create file
-	del(fname);
-	touch(fname);
-	write_start(fname, fwrite);
-	
-	lcd_printf("Saving: %dkB\n", (unsigned int)(psize/1024));
-	lcd_go_line(1);
+	return CAMERA_SAVED;
+}
 
-	// receive packets
-	unsigned int i, packet_size, packet_id;
-	
-	for (i=0; i<packets; i++) {
-		_delay_ms(10);
-		
-		// draw progress bar
-		if (i && !(i%load_bar)) lcd_wdata('=');
-		//lcd_go_line(1); // debug
-		//lcd_print_int(i);
-
-		// request next packet
-		camera_readpos = camera_writepos = 0;
-		camera_snd_cmd(CAMERA_ACK, 0, 0, i&0xff, (i>>8)&0xff);
-		camera_rcv(128);
-
-		// get packet id and size from packet
-		packet_id = (unsigned int)camera_buf[0] | (((unsigned int)camera_buf[1])<<8);
-		packet_size = (unsigned int)camera_buf[2] | (((unsigned int)camera_buf[3])<<8);
-		
-		// error out if we lose a packet
-		if (packet_id != i) {
-			lcd_printf("camera error:\npacket");
-			while (1) ;
+// saves the packet that came in, or asks for it again
+static char camera_packet(void)
+{
+	unsigned int i = camera_pkt_i, packet_size, packet_id;
+	unsigned char b = i & 1;
+	volatile unsigned char * pkt = camera_pkt[b];
+
+	// ask again once the line has been quiet for 5 ms
+	if (camera_do == CAMERA_DO_QUIET) {
+		if (camera_quiet_n != camera_rxcount) {
+			camera_quiet_n = camera_rxcount;
+			camera_t = sched_now();
+			return CAMERA_BUSY;
 		}
-		
-		// write to file
-		write_add(fwrite, (char *)(camera_buf+4), packet_size);
+		if ((uint16_t)(sched_now() - camera_t) < 5) return CAMERA_BUSY;
+		camera_pktrestart(b);
+		camera_snd_cmd(CAMERA_ACK, 0, 0, i&0xff, (i>>8)&0xff);
+		camera_t = sched_now();
+		return camera_then(CAMERA_DO_PACKET);
 	}
-	
-	// finish
-	camera_snd_cmd(CAMERA_ACK, 0, 0, 0xf0, 0xf0);
-	write_add(fwrite, (char*)CAMERA_JPGENDMARKER, 2);
-	write_end(fwrite);
-	
-	lcd_printf("camera: saved\n");
+
+	// the camera only sends a packet when asked, give it its time
+	if (!camera_pktready[b] && (uint16_t)(sched_now() - camera_t) < CAMERA_PKT_TIMEOUT)
+		return CAMERA_BUSY;
+
+	PROF_SCOPE(PROF_PHOTO_STEP);
+	IOSTAT_PART(IOSTAT_PHOTO);
+
+	// get packet id and size from packet
+	packet_id = (unsigned int)pkt[0] | (((unsigned int)pkt[1])<<8);
+	packet_size = (unsigned int)pkt[2] | (((unsigned int)pkt[3])<<8);
+
+	// lost, garbled or out of order, ask again once the line is quiet
+	if (camera_pktready[b] != CAMERA_PKT_OK || packet_id != i || packet_size > camera_pkglen - 6) {
+		if (++camera_retries > CAMERA_RETRIES) return camera_photo_end();
+		camera_quiet_n = camera_rxcount;
+		camera_t = sched_now();
+		return camera_then(CAMERA_DO_QUIET);
+	}
+	camera_retries = 0;
+
+	// request the next packet right away, it streams into the other
+	// buffer while this one goes to the card
+	if (i + 1 < camera_packets) {
+		camera_snd_cmd(CAMERA_ACK, 0, 0, (i+1)&0xff, ((i+1)>>8)&0xff);
+		camera_t = sched_now();
+	}
+
+	// draw progress bar
+	if (camera_bar && i && !(i%camera_load_bar)) lcd_wdata('=');
+
+	// write to file, the EXIF segment goes in right after SOI
+	if (i == 0 && camera_geotag && packet_size >= 2 && pkt[4] == 0xff && pkt[5] == 0xd8) {
+		write_add(camera_fw, (char *)(pkt+4), 2);
+		exif_gps(camera_fw, &camera_gl);
+		write_add(camera_fw, (char *)(pkt+6), packet_size - 2);
+	} else {
+		write_add(camera_fw, (char *)(pkt+4), packet_size);
+	}
+	camera_pktready[b] = CAMERA_PKT_EMPTY;
+	camera_pkt_i = ++i;
+
+	return i < camera_packets ? CAMERA_BUSY : camera_photo_end();
+}
+
+char camera_photo_step(void)
+{
+	unsigned char r;
+
+	if (camera_do == CAMERA_DO_PACKET || camera_do == CAMERA_DO_QUIET) return camera_packet();
+	if (camera_do == CAMERA_DO_IDLE) return CAMERA_FAILED;
+
+	// as far as the replies in so far go
+	while ((r = camera_io_poll()) != CAMERA_IO_BUSY) {
+		if ((r = camera_next(r)) != CAMERA_BUSY) return r;
+		if (camera_do == CAMERA_DO_PACKET) break;
+	}
+	return CAMERA_BUSY;
+}
+
+unsigned char camera_photo_progress(void)
+{
+	return camera_packets ? (unsigned long)camera_pkt_i * 100 / camera_packets : 0;
+}
+
+// takes a photo and saves it as fname in the current directory, geotagged with gl unless it's NULL
+// returns 0, or 1 if the camera stopped answering and the file is incomplete
+char camera_takephoto(const char * fname, const struct gps_location * gl, struct fatwrite_t * fwrite)
+{
+	char r;
+
+	lcd_printf_P(PSTR("camera: photo"));
+	camera_photo_start(fname, gl, fwrite);
+
+	camera_bar = 1;
+	r = camera_finish();
+	camera_bar = 0;
+	if (r == CAMERA_FAILED) return 1;
+
+	lcd_printf_P(PSTR("camera: saved\n"));
 	_delay_ms(200);
+	return 0;
 }
 
 // send a single byte to the camera
+#ifdef CAMERA_SIM
+void camsim_txbyte(char c);	// host/camsim.c plays the camera
+#endif
 void camera_txbyte(char c)
 {
+#ifdef CAMERA_SIM
+	camsim_txbyte(c);
+#else
 	while ((UCSR1A&(1<<UDRE1)) == 0); // wait until empty
 	UDR1 = c;
+#endif
 }
 
 // check if there is an unread response from the camera
 char camera_response(void)
 {
-	if (camera_writepos - camera_readpos >= 6) return 1;
+	if (((camera_writepos - camera_readpos) & CAMERA_RINGMASK) >= 6) return 1;
 	return 0;
 }
 
@@ -183,7 +709,7 @@ unsigned char camera_rcv(int n)
 	unsigned char r = camera_readpos;
 	for (i=0; i<n; i++) {
 		while (!CAMERA_DATAREADY()) ;
-		camera_readpos++;
+		camera_readpos = (camera_readpos + 1) & CAMERA_RINGMASK;
 	}
 	return r;
 }
@@ -214,6 +740,48 @@ void camera_snd_cmd(char cmd, char b3, char b4, char b5, char b6)
 // interrupt service routine that listens to the camera
 ISR(USART1_RX_vect)
 {
-	camera_buf[camera_writepos++] = UDR1;
-}
+	unsigned char c = UDR1, next;
+	volatile unsigned char * pkt;
 
+	camera_rxcount++;
+
+	if (!camera_pktmode) {
+		next = (camera_writepos + 1) & CAMERA_RINGMASK;
+		if (next == camera_readpos) {
+			camera_overruns++;
+		} else {
+			camera_buf[camera_writepos] = c;
+			camera_writepos = next;
+		}
+		// a whole reply, camera_photo_step() can take it on
+		if (((camera_writepos - camera_readpos) & CAMERA_RINGMASK) == 6) sched_post(SCHED_CAMERA);
+		return;
+	}
+
+	// nowhere to put it, the packet before hasn't been written out yet
+	if (camera_pktready[camera_pktfill]) {
+		camera_overruns++;
+		return;
+	}
+
+	// packet: id (2), data size (2), data, verify code (2)
+	// the verify code is the sum of all bytes before it, low byte first
+	pkt = camera_pkt[camera_pktfill];
+	if (camera_pktpos < CAMERA_PKGMAX) pkt[camera_pktpos] = c;
+	if (!camera_pktpos) camera_pktsum = 0;
+	camera_pktpos++;
+	if (camera_pktpos == 4)
+		camera_pktlen = 6 + ((unsigned int)pkt[2] | ((unsigned int)pkt[3] << 8));
+	if (camera_pktpos <= 4 || camera_pktpos <= camera_pktlen - 2)
+		camera_pktsum += c;
+
+	// complete, flip to the other buffer for the next one
+	if (camera_pktpos > 4 && camera_pktpos >= camera_pktlen) {
+		camera_pktready[camera_pktfill] = (camera_pktlen <= CAMERA_PKGMAX &&
+			pkt[camera_pktlen - 2] == camera_pktsum) ? CAMERA_PKT_OK : CAMERA_PKT_BAD;
+		camera_pktfill ^= 1;
+		camera_pktpos = 0;
+		sched_post(SCHED_CAMERA);
+		trace_add(TRACE_CAM_PACKET, pkt[0]);
+	}
+}
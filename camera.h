@@ -5,10 +5,42 @@
 #include <inttypes.h>
 
 struct fatwrite_t;
+struct gps_location;
+
+// JPEG resolutions
+#define CAMERA_RES_160 0x03	//160 x 128
+#define CAMERA_RES_320 0x05	//320 x 240
+#define CAMERA_RES_640 0x07	//640 x 480
 
 // camera functions
+
+/* syncs, tunes the link and sets the picture up, hangs if there is no camera */
 void camera_init(void);
-void camera_takephoto(const char * fname, struct fatwrite_t * fwrite);
+
+/* camera_init() sets up a session that lasts between photos:
+ * camera_standby() keeps the camera awake and configured, camera_sleep()
+ * powers it down, and camera_wake() gets it ready for camera_takephoto()
+ * the cheapest way it can, falling back to a full re-sync
+ * camera_wake() returns 0 when ready, 1 if the camera didn't answer
+ */
+char camera_wake(void);
+void camera_standby(void);
+
+/* resolution for the following photos, sent on the next camera_wake() */
+void camera_resolution(unsigned char res);
+char camera_takephoto(const char * fname, const struct gps_location * gl, struct fatwrite_t * fwrite);
+
+/* the same photo without waiting for it, camera_photo_start() only asks
+ * for it, each camera_photo_step() then takes the wake, the snapshot and
+ * the download on as far as the camera's replies allow and returns
+ * CAMERA_BUSY until the photo is CAMERA_SAVED or CAMERA_FAILED
+ */
+#define CAMERA_BUSY 0
+#define CAMERA_SAVED 1
+#define CAMERA_FAILED 2
+void camera_photo_start(const char * fname, const struct gps_location * gl, struct fatwrite_t * fwrite);
+char camera_photo_step(void);
+unsigned char camera_photo_progress(void);	//percent saved
 void camera_txbyte(char c);
 char camera_response(void);
 void camera_rcv_cmd(unsigned char * cmdbuf);
@@ -0,0 +1,75 @@
+//////////////////////////////////
+//Capture policy		//
+//how big and how often photos	//
+//are taken for the speed	//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+#include "gps.h"
+#include "camera.h"
+#include "capture.h"
+#include "geo.h"
+#include "trklog.h"
+
+// largest first, with a save time guess until one has been measured (seconds * 16)
+static const uint8_t capture_res[CAPTURE_SIZES] PROGMEM = {CAMERA_RES_640, CAMERA_RES_320, CAMERA_RES_160};
+static const uint8_t capture_guess[CAPTURE_SIZES] PROGMEM = {64, 32, 16};
+
+void capture_init(struct capture_state * c)
+{
+	uint8_t i;
+
+	c->started = 0;
+	c->pending = 0;
+	for (i=0; i<CAPTURE_SIZES; i++)
+		c->cost[i] = pgm_read_byte(&capture_guess[i]);
+}
+
+unsigned char capture_check(struct capture_state * c, const struct gps_location * gl)
+{
+	uint32_t now = trk_time(gl->date, gl->time), dt;
+	int32_t x, y;
+	uint8_t size;
+
+	// one photo at a time
+	if (c->pending) return 0;
+
+	if (gl->isog < CAPTURE_MIN_SOG) return 0;
+
+	// biggest photo that saves before we've gone CAPTURE_BLIND_CM
+	for (size=0; size<CAPTURE_SIZES-1; size++)
+		if ((uint32_t)gl->isog * c->cost[size] <= CAPTURE_BLIND_CM * 16UL) break;
+
+	if (c->started) {
+		// keep pace with the fixes, the camera gets at most 1 / CAPTURE_DUTY of them
+		dt = now - c->time;
+		if (dt * 16 < (uint32_t)CAPTURE_DUTY * c->cost[size]) return 0;
+
+		// moved far enough
+		if (dt < CAPTURE_MAX_S) {
+			geo_offset_cm(c->lat, c->lon, c->coslat, gl->ilat, gl->ilon, &x, &y);
+			if ((int64_t)x * x + (int64_t)y * y < (int64_t)CAPTURE_DIST_CM * CAPTURE_DIST_CM)
+				return 0;
+		}
+	}
+
+	c->started = 1;
+	c->pending = 1;
+	c->lat = gl->ilat;
+	c->lon = gl->ilon;
+	c->coslat = geo_coslat(gl->ilat);
+	c->time = now;
+	c->size = size;
+
+	return pgm_read_byte(&capture_res[size]);
+}
+
+void capture_saved(struct capture_state * c, uint16_t cost)
+{
+	if (!c->pending) return;
+	if (cost < 16) cost = 16;
+	if (cost > 60 * 16) cost = 60 * 16;
+	c->cost[c->size] += ((int16_t)cost - (int16_t)c->cost[c->size]) / 4;
+	c->pending = 0;
+}
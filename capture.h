@@ -0,0 +1,44 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <inttypes.h>
+
+struct gps_location;
+
+/* tunables, distances in centimeters and speeds in cm/s */
+#define CAPTURE_MIN_SOG 50	//standing still below this, no photos
+#define CAPTURE_DIST_CM 2000	//photo this far from the last one
+#define CAPTURE_MAX_S 30	//or this long after it, while moving
+#define CAPTURE_BLIND_CM 3000	//most ground to cover while a photo saves
+#define CAPTURE_DUTY 2		//photos at least this many save times apart
+#define CAPTURE_SIZES 3		//640 x 480, 320 x 240, 160 x 128
+
+/* photo policy, the camera saves one photo at a time so the measured
+ * save time of each resolution decides how big and how often photos
+ * can be taken at the current speed
+ */
+struct capture_state {
+	char started;
+	char pending;		//photo saving, not measured yet
+	int32_t lat;		//last photo, degrees * 1e7
+	int32_t lon;
+	int32_t coslat;		//cos(lat) in Q2.30, shrinks longitude to centimeters
+	uint32_t time;		//last photo, seconds since 2000
+	uint8_t size;		//resolution of the last photo
+	uint16_t cost[CAPTURE_SIZES];	//average save time per resolution, seconds * 16
+};
+
+void capture_init(struct capture_state * c);
+
+/* called with every valid fix while logging, returns the camera resolution
+ * to take a photo with or 0 for none, a photo is assumed taken when it
+ * returns nonzero and no other is asked for until capture_saved()
+ */
+unsigned char capture_check(struct capture_state * c, const struct gps_location * gl);
+
+/* the photo is done, cost is how long it took to save (seconds * 16),
+ * a failed photo counts too
+ */
+void capture_saved(struct capture_state * c, uint16_t cost);
+
+#endif
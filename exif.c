@@ -0,0 +1,128 @@
+//////////////////////////////////
+//EXIF GPS tags			//
+//geotags photos as they are	//
+//written to the card		//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+#include "gps.h"
+#include "fat32.h"
+#include "exif.h"
+#include "fmt.h"
+
+// TIFF types
+#define EXIF_BYTE 1
+#define EXIF_ASCII 2
+#define EXIF_LONG 4
+#define EXIF_RATIONAL 5
+
+// where the values too big for an entry go, offsets from the TIFF header
+#define EXIF_GPSIFD 26
+#define EXIF_LAT 164
+#define EXIF_LON 188
+#define EXIF_TIME 212
+#define EXIF_SPEED 236
+#define EXIF_TRACK 244
+#define EXIF_DATE 252
+#define EXIF_END 263
+
+// APP1 marker and length, TIFF header (little endian) and IFD0 pointing at the GPS IFD
+static const uint8_t exif_head[] PROGMEM = {
+	0xff, 0xe1, (EXIF_END + 8) >> 8, (EXIF_END + 8) & 0xff,
+	'E', 'x', 'i', 'f', 0, 0,
+	'I', 'I', 0x2a, 0, 8, 0, 0, 0,
+	1, 0,
+	0x25, 0x88, EXIF_LONG, 0, 1, 0, 0, 0, EXIF_GPSIFD, 0, 0, 0,
+	0, 0, 0, 0,		// no IFD after this one
+	11, 0
+};
+
+static void exif_put(uint8_t * p, uint32_t v, uint8_t n)
+{
+	while (n--) {
+		*p++ = v;
+		v >>= 8;
+	}
+}
+
+/* one IFD entry, value is the data itself when it fits in 4 bytes */
+static void exif_entry(struct fatwrite_t * fwrite, uint16_t tag, uint8_t type, uint16_t count, uint32_t value)
+{
+	uint8_t buf[12];
+
+	exif_put(buf, tag, 2);
+	exif_put(buf + 2, type, 2);
+	exif_put(buf + 4, count, 4);
+	exif_put(buf + 8, value, 4);
+	write_add(fwrite, (const char *)buf, 12);
+}
+
+static void exif_rational(struct fatwrite_t * fwrite, uint32_t num, uint32_t den)
+{
+	uint8_t buf[8];
+
+	exif_put(buf, num, 4);
+	exif_put(buf + 4, den, 4);
+	write_add(fwrite, (const char *)buf, 8);
+}
+
+/* degrees * 1e7 as degrees and minutes to 1e-5 */
+static void exif_coord(struct fatwrite_t * fwrite, int32_t e7)
+{
+	uint32_t v = (e7 < 0) ? -e7 : e7;
+
+	exif_rational(fwrite, v / 10000000UL, 1);
+	exif_rational(fwrite, (v % 10000000UL) * 3 / 5, 100000UL);
+	exif_rational(fwrite, 0, 1);
+}
+
+void exif_gps(struct fatwrite_t * fwrite, const struct gps_location * gl)
+{
+	char date[11];
+	uint16_t ms = 0;
+
+	write_add_P(fwrite, (const char *)exif_head, sizeof(exif_head));
+
+	// GPS IFD, tags in ascending order
+	exif_entry(fwrite, 0x00, EXIF_BYTE, 4, 0x0202);			// version 2.2
+	exif_entry(fwrite, 0x01, EXIF_ASCII, 2, (gl->ilat < 0) ? 'S' : 'N');
+	exif_entry(fwrite, 0x02, EXIF_RATIONAL, 3, EXIF_LAT);
+	exif_entry(fwrite, 0x03, EXIF_ASCII, 2, (gl->ilon < 0) ? 'W' : 'E');
+	exif_entry(fwrite, 0x04, EXIF_RATIONAL, 3, EXIF_LON);
+	exif_entry(fwrite, 0x07, EXIF_RATIONAL, 3, EXIF_TIME);
+	exif_entry(fwrite, 0x0c, EXIF_ASCII, 2, 'K');			// km/h
+	exif_entry(fwrite, 0x0d, EXIF_RATIONAL, 1, EXIF_SPEED);
+	exif_entry(fwrite, 0x0e, EXIF_ASCII, 2, 'T');			// true north
+	exif_entry(fwrite, 0x0f, EXIF_RATIONAL, 1, EXIF_TRACK);
+	exif_entry(fwrite, 0x1d, EXIF_ASCII, 11, EXIF_DATE);
+
+	// no next IFD, then the values
+	write_add_P(fwrite, (const char *)exif_head + 32, 4);	// the zeros ending IFD0
+	exif_coord(fwrite, gl->ilat);
+	exif_coord(fwrite, gl->ilon);
+
+	// hhmmss.sss
+	if (gl->time[6] == '.')
+		ms = (gl->time[7] - '0') * 100 + (gl->time[8] - '0') * 10 + (gl->time[9] - '0');
+	exif_rational(fwrite, fmt_two_digits(gl->time), 1);
+	exif_rational(fwrite, fmt_two_digits(gl->time + 2), 1);
+	exif_rational(fwrite, fmt_two_digits(gl->time + 4) * 1000UL + ms, 1000);
+
+	exif_rational(fwrite, gl->isog * 36UL, 1000);	// cm/s to km/h
+	exif_rational(fwrite, gl->icog, 100);
+
+	// ddmmyy to YYYY:MM:DD
+	date[0] = '2';
+	date[1] = '0';
+	date[2] = gl->date[4];
+	date[3] = gl->date[5];
+	date[4] = ':';
+	date[5] = gl->date[2];
+	date[6] = gl->date[3];
+	date[7] = ':';
+	date[8] = gl->date[0];
+	date[9] = gl->date[1];
+	date[10] = '\0';
+	write_add(fwrite, date, 11);
+}
@@ -0,0 +1,14 @@
+#ifndef EXIF_H
+#define EXIF_H
+
+struct fatwrite_t;
+struct gps_location;
+
+#define EXIF_GPS_LEN 273	//bytes exif_gps() writes, marker included
+
+/* writes an APP1 segment with the fix as EXIF GPS tags, it goes right
+ * after the JPEG's SOI marker so photos come off the card geotagged
+ */
+void exif_gps(struct fatwrite_t * fwrite, const struct gps_location * gl);
+
+#endif
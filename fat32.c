@@ -3,21 +3,26 @@
 #include "serial.h"
 #include "convert.h"
 #include "lcd.h"
+#include "prof.h"
+#include "iostat.h"
 
 #include <inttypes.h>
 #include <ctype.h>
+#include <avr/pgmspace.h>
 
 /* macros to aid in reading data from byte buffers */
 #define GET32(p) (*((uint32_t*)(p)))
 #define GET16(p) (*((uint16_t*)(p)))
 #define FAT_EOF 0x0ffffff8
 #define FAT_DIRATTRIB 0x10
+#define SECT_NONE 0xffffffff
 
 /* the global fat32 fs structure */
 static struct fat32fs_t fat;
 #define CLUSTER(cn) ((fat.cluster_begin_lba + ((uint32_t)(((cn > 1) ? (cn) : fat.root_dir_first_cluster) & 0x0fffffff) - 2) * fat.sectors_per_cluster) & 0x0fffffff)
 #define SECTOR(sn) (((sn) - fat.cluster_begin_lba) / fat.sectors_per_cluster + 2)
 #define FIXCLUSTERNUM(cn) ((cn > 1) ? (cn) : fat.root_dir_first_cluster)
+#define FATSECTOR(cn) ((FIXCLUSTERNUM(cn) >> 7) + fat.fat_begin_lba)
 
 /* global directory entry data for parameter passing and holding the current directory */
 static struct fat32dirent_t ret_file;
@@ -26,21 +31,37 @@ static const char* fncmp;
 static int ret_value;
 static uint32_t ret_lcluster;
 
-/* shared sector buffers */
+/* shared sector buffer */
 /* each routine is responsible for writing its own buffer modifications to memory */
-/* these buffers are provided merely for convience and to save on memory usage */
+/* this buffer is provided merely for convience and to save on memory usage */
+/* FAT sectors go through it too, so nothing may hold a directory sector in it across a FAT call */
 static uint8_t sect[512];
 static uint32_t cur_sect;
 static uint8_t* cur_line;
-static uint32_t fatsect[512 / sizeof(uint32_t)];
-static uint32_t cur_fatsect;
+
+/* which sector the shared buffer holds as it is on the card, so walking
+ * the same directory again (every write_append) or following a chain
+ * through the same FAT sector doesn't reread it
+ */
+static uint32_t sect_lba = SECT_NONE;
+
+/* no free clusters before this FAT sector, fat_clearchain() moves it back */
+static uint32_t free_fatsect;
 
 /* abstract readsector with error checking */
 int readsector(uint32_t lba, uint8_t *buffer)
 {
 	int r;
+
+	if (buffer == sect) {
+		if (lba == sect_lba) return 0;
+		sect_lba = SECT_NONE;
+	}
+
 	if ((r = mmc_readsector(lba, buffer)))
-		lcd_printf("SD error:\nreading sector");
+		lcd_printf_P(PSTR("SD error:\nreading sector"));
+	else if (buffer == sect)
+		sect_lba = lba;
 	return r;
 }
 
@@ -48,8 +69,15 @@ int readsector(uint32_t lba, uint8_t *buffer)
 int writesector(uint32_t lba, uint8_t *buffer)
 {
 	int r;
+
+	// a write from another buffer makes the cached copy stale
+	if (buffer == sect || lba == sect_lba)
+		sect_lba = SECT_NONE;
+
 	if ((r = mmc_writesector(lba, buffer)))
-		lcd_printf("SD error:\nwriting sector");
+		lcd_printf_P(PSTR("SD error:\nwriting sector"));
+	else if (buffer == sect)
+		sect_lba = lba;
 	return r;
 }
 
@@ -83,20 +111,42 @@ const char* str_to_fat(const char * str)
 	return name;
 }
 
+/* FAT sector s in the shared buffer, read only if it isn't there already */
+static uint32_t * fat_load(uint32_t s)
+{
+	if (s != sect_lba) IOSTAT_ADD(fat_reads, 1);
+	readsector(s, sect);
+	return (uint32_t*)sect;
+}
+
+/* writes the FAT sector in the shared buffer to both FATs, the mirror
+ * first so the buffer is left holding s
+ */
+static void fat_store(uint32_t s)
+{
+	IOSTAT_ADD(fat_writes, 2);
+	writesector(s + fat.sectors_per_fat, sect);
+	writesector(s, sect);
+}
+
 /* finds an empty FAT cluster */
 uint32_t fat_findempty(void)
 {
 	unsigned int i;
+	uint32_t s, * f;
+	PROF_SCOPE(PROF_FINDEMPTY);
 
-	for (cur_fatsect = fat.fat_begin_lba; cur_fatsect < fat.fat_begin_lba + fat.sectors_per_fat; cur_fatsect++) {
-		readsector(cur_fatsect, (uint8_t*)fatsect);
+	for (s = free_fatsect; s < fat.fat_begin_lba + fat.sectors_per_fat; s++) {
+		f = fat_load(s);
 		for (i=0; i<16; i++)
-			if (!fatsect[i])
-				return ((cur_fatsect - fat.fat_begin_lba) << 7) | i;
+			if (!f[i]) {
+				free_fatsect = s;
+				return ((s - fat.fat_begin_lba) << 7) | i;
+			}
 	}
 
 	// hang
-	lcd_printf("filesystem\nis full");
+	lcd_printf_P(PSTR("filesystem\nis full"));
 	while (1) ;
 
 	return 0x0fffffff; // out of space
@@ -105,35 +155,22 @@ uint32_t fat_findempty(void)
 /* reads the next cluster from the FAT */
 uint32_t fat_readnext(uint32_t cur_cluster)
 {
-	// compute FAT sector and index
-	cur_cluster = FIXCLUSTERNUM(cur_cluster);
-	uint32_t s = ((cur_cluster >> 7) + fat.fat_begin_lba);
-	uint16_t i = cur_cluster & 0x7f;
-	
-	// load next FAT sector into buffer
-	if (cur_fatsect != s) {
-		cur_fatsect = s;
-		readsector(cur_fatsect, (uint8_t*)fatsect);
-	}
-	
-	// return next cluster
-	return fatsect[i];
+	return fat_load(FATSECTOR(cur_cluster))[FIXCLUSTERNUM(cur_cluster) & 0x7f];
 }
 
 /* writes the next cluster to the FAT */
 /* uses a blocking write-through philosophy for the buffer, which can be inefficient */
 uint32_t fat_writenext(uint32_t cur_cluster, uint32_t new_cluster)
 {
+	uint32_t s = FATSECTOR(cur_cluster);
+	uint32_t * f = fat_load(s);
 	uint32_t r;
 
-	// load the next FAT sector into buffer
-	cur_cluster = FIXCLUSTERNUM(cur_cluster);
-	r = fat_readnext(cur_cluster);
-
 	// write FAT sectors (mirrored FATs)
-	fatsect[cur_cluster & 0x7f] = new_cluster;
-	writesector(cur_fatsect, (uint8_t*)fatsect);
-	writesector(cur_fatsect + fat.sectors_per_fat, (uint8_t*)fatsect);
+	cur_cluster = FIXCLUSTERNUM(cur_cluster);
+	r = f[cur_cluster & 0x7f];
+	f[cur_cluster & 0x7f] = new_cluster;
+	fat_store(s);
 
 	// return next cluster
 	return r;
@@ -142,36 +179,30 @@ uint32_t fat_writenext(uint32_t cur_cluster, uint32_t new_cluster)
 /* clears a FAT cluster chain more efficiently than repeatedly calling fat_writenext() */
 void fat_clearchain(uint32_t first_cluster)
 {
-	uint32_t cur_cluster = first_cluster;
-
-	// compute FAT sector and index of the first cluster
-	cur_cluster = FIXCLUSTERNUM(cur_cluster);
-	uint32_t s = ((cur_cluster >> 7) + fat.fat_begin_lba);
+	uint32_t cur_cluster = FIXCLUSTERNUM(first_cluster);
+	uint32_t s = FATSECTOR(cur_cluster), next_s;
 	uint16_t i = cur_cluster & 0x7f;
-	
+	uint32_t * f;
+
+	free_fatsect = fat.fat_begin_lba;
 
 	while (cur_cluster != 0 && cur_cluster < FAT_EOF) {
 		// load next FAT sector into buffer if not already there
-		if (cur_fatsect != s) {
-			cur_fatsect = s;
-			readsector(cur_fatsect, (uint8_t*)fatsect);
-		}
-		
+		f = fat_load(s);
+
 		// update FAT sector buffer
-		cur_cluster = fatsect[i];
-		fatsect[i] = 0;
-	
+		cur_cluster = f[i];
+		f[i] = 0;
+
 		// compute FAT sector and index
-		s = ((cur_cluster >> 7) + fat.fat_begin_lba);
+		next_s = (cur_cluster >> 7) + fat.fat_begin_lba;
 		i = cur_cluster & 0x7f;
 
 		// write FAT sector buffer to memory
-		if (cur_fatsect != s || cur_cluster == 0 || cur_cluster >= FAT_EOF) {
-			writesector(cur_fatsect, (uint8_t*)fatsect);
-			writesector(cur_fatsect + fat.sectors_per_fat, (uint8_t*)fatsect);
-		}
+		if (next_s != s || cur_cluster == 0 || cur_cluster >= FAT_EOF)
+			fat_store(s);
+		s = next_s;
 	}
-
 }
 
 /* fills a fat32dirent_t from raw data */
@@ -212,22 +243,22 @@ int init_partition(int part)
 	
 	// read MBR
 	if (readsector(0, sect)) {
-		lcd_printf("error: problem\nreading sector");
+		lcd_printf_P(PSTR("error: problem\nreading sector"));
 		return 1;	
 	} else {
-		lcd_printf("init part. #%d\n", part + 1);
+		lcd_printf_P(PSTR("init part. #%d\n"), part + 1);
 	}
 	
 	// sanity check
 	if (GET16(sect + 510) != 0xaa55) {
-		lcd_printf("error: bad MBR\n");
+		lcd_printf_P(PSTR("error: bad MBR\n"));
 		return 2;
 	}
 	
 	// check if partition is fat32
 	p = sect + 446 + part*16;
 	if (p[4] != 0x0b && p[4] != 0x0c) {
-		lcd_printf("error: not FAT32\n");
+		lcd_printf_P(PSTR("error: not FAT32\n"));
 		return 3;
 	}
 	
@@ -236,24 +267,24 @@ int init_partition(int part)
 	
 	// read partition Volume ID
 	if (readsector(fat.partition_begin_lba, sect)) {
-		lcd_printf("error: sector read\n");
+		lcd_printf_P(PSTR("error: sector read\n"));
 		return 1;	
 	}
 	
 	// check bytes per sector (should be 512)
 	if (GET16(sect + 0xb) != 512) {
-		lcd_printf("error: non-512b sectors\n");
+		lcd_printf_P(PSTR("error: non-512b sectors\n"));
 		return 4;
 	}
 	
 	// check for 2 FATs
 	if (sect[0x10] != 2) {
-		lcd_printf("warning: not\nmirrored FATs");
+		lcd_printf_P(PSTR("warning: not\nmirrored FATs"));
 	}
 	
 	// sanity check
 	if (GET16(sect + 510) != 0xaa55) {
-		lcd_printf("error: missing Vol ID sig\n");
+		lcd_printf_P(PSTR("error: missing Vol ID sig\n"));
 		return 2;
 	}
 	
@@ -270,9 +301,8 @@ int init_partition(int part)
 	// root directory first cluster
 	fat.root_dir_first_cluster = GET32(sect + 0x2c);
 	
-	// read in the first sector of the first FAT cluster
-	cur_fatsect = fat.fat_begin_lba;
-	readsector(fat.fat_begin_lba, (uint8_t*)fatsect);
+	// free clusters are looked for from the start of the FAT
+	free_fatsect = fat.fat_begin_lba;
 	
 	// set current directory to root directory
 	cur_dir.cluster = fat.root_dir_first_cluster;
@@ -356,6 +386,7 @@ void loop_dir(uint32_t fcluster, char (*funct)(struct fat32dirent_t*))
 {
 	uint32_t cluster = fcluster;
 	uint32_t fsect = cur_sect = CLUSTER(fcluster);
+	IOSTAT_ADD(dir_scans, 1);
 	readsector(cur_sect, sect);
 	
 	uint8_t* p = sect;
@@ -483,13 +514,13 @@ void del(const char * s)
 	
 	if (!IS_FILE(ret_file) || IS_SUBDIR(ret_file)) return;
 
+	// erase directory entry, before the FAT takes over the buffer
+	*cur_line = 0xe5;
+	writesector(cur_sect, sect);
+
 	// clear FAT chain
 	if (ret_file.cluster != 0)
 		fat_clearchain(ret_file.cluster);
-	
-	// erase directory entry
-	*cur_line = 0xe5;
-	writesector(cur_sect, sect);
 }
 
 #if 0 // debugging
@@ -502,7 +533,7 @@ void cat(const char * s)
 	// print if a printable file
 	if (IS_FILE(ret_file) && !IS_SUBDIR(ret_file))
 		loop_file(ret_file.cluster, ret_file.size, print_sect);
-	else lcd_printf("non-printable file");
+	else lcd_printf_P(PSTR("non-printable file"));
 	
 	send_char('\n');
 }
@@ -585,14 +616,18 @@ char mkdir(const char * dirname)
 	if (exists(dirname)) return -1;
 	touch(dirname);
 
+	// get an empty cluster, before the dirent is found since the FAT
+	// goes through the same buffer
+	uint32_t tmp_fat = fat_findempty();
+	fat_writenext(tmp_fat, FAT_EOF);
+
 	fncmp = str_to_fat(dirname);
 	loop_dir(cur_dir.cluster, find_dirent);
-	if (!IS_FILE(ret_file)) return -2;
+	if (!IS_FILE(ret_file)) {
+		fat_writenext(tmp_fat, 0);
+		return -2;
+	}
 
-	// get an empty cluster
-	uint32_t tmp_fat = fat_findempty();
-	fat_writenext(tmp_fat, FAT_EOF);
-	
 	// set directory bits and point to cluster
 	GET16(cur_line + 0x14) = tmp_fat>>16;
 	GET16(cur_line + 0x1a) = tmp_fat;
@@ -647,6 +682,12 @@ int dir_highestnumbered(void)
 
 /* routines for writing to empty files created with touch() */
 
+/* the sector a write fills, the shared one unless the file brought its own */
+static uint8_t * write_buf(struct fatwrite_t * fwrite)
+{
+	return fwrite->buf ? fwrite->buf : sect;
+}
+
 char write_start(const char * s, struct fatwrite_t * fwrite)
 {
 	fncmp = str_to_fat(s);
@@ -699,7 +740,7 @@ char write_append(const char * s, struct fatwrite_t * fwrite)
 	fwrite->dir = cur_dir.cluster;
 
 	// read in buffer
-	readsector(CLUSTER(fwrite->cur_cluster) + fwrite->sector_offset, fwrite->buf);
+	readsector(CLUSTER(fwrite->cur_cluster) + fwrite->sector_offset, write_buf(fwrite));
 	
 	return 1;
 }
@@ -708,12 +749,16 @@ void write_add(struct fatwrite_t * fwrite, const char * buf, int count)
 {
 	int i;
 	uint32_t oldcluster;
+	uint8_t * b = write_buf(fwrite);
+
+	// the shared sector stops matching the card as soon as it's written to
+	if (b == sect) sect_lba = SECT_NONE;
 
 	for (i=0; i<count; i++) {
 		// filled sector, write out
 		if (fwrite->sect_i >= 512) {
 			//write_end(fwrite);
-			writesector(CLUSTER(fwrite->cur_cluster) + fwrite->sector_offset, fwrite->buf);
+			writesector(CLUSTER(fwrite->cur_cluster) + fwrite->sector_offset, b);
 			// new cluster
 			fwrite->sector_offset++;
 			if (fwrite->sector_offset >= fat.sectors_per_cluster) {
@@ -728,18 +773,34 @@ void write_add(struct fatwrite_t * fwrite, const char * buf, int count)
 
 			// reset buffer index for the new sector
 			fwrite->sect_i = 0;
+			if (b == sect) sect_lba = SECT_NONE;
 		}
 		
 		// copy next byte to buffer
-		fwrite->buf[fwrite->sect_i++] = buf[i];
+		b[fwrite->sect_i++] = buf[i];
 		fwrite->size++;
 	}
 }
 
+/* write_add() from program memory, through a small bounce buffer */
+void write_add_P(struct fatwrite_t * fwrite, const char * buf, int count)
+{
+	char chunk[16];
+	int n;
+
+	while (count > 0) {
+		n = (count > (int)sizeof(chunk)) ? (int)sizeof(chunk) : count;
+		memcpy_P(chunk, buf, n);
+		write_add(fwrite, chunk, n);
+		buf += n;
+		count -= n;
+	}
+}
+
 void write_end(struct fatwrite_t * fwrite)
 {
 	// write out current buffer and ensure fat chain terminates with an EOF
-	writesector(CLUSTER(fwrite->cur_cluster) + fwrite->sector_offset, fwrite->buf);
+	writesector(CLUSTER(fwrite->cur_cluster) + fwrite->sector_offset, write_buf(fwrite));
 	fat_writenext(fwrite->cur_cluster, FAT_EOF);
 	
 	// find file in dir
@@ -760,3 +821,65 @@ void write_end(struct fatwrite_t * fwrite)
 	writesector(cur_sect, sect);
 }
 
+/* routines for reading files, a sector at a time so a transfer can go back */
+
+char read_start(const char * s, struct fatread_t * fread)
+{
+	fncmp = str_to_fat(s);
+
+	loop_dir(cur_dir.cluster, find_dirent);
+	if (!IS_FILE(ret_file) || IS_SUBDIR(ret_file))
+		return 0;
+
+	fread->f_cluster = ret_file.cluster;
+	fread->size = ret_file.size;
+	fread->cur_cluster = fread->f_cluster;
+	fread->sector_offset = 0;
+	fread->pos = 0;
+
+	return 1;
+}
+
+void read_seek(struct fatread_t * fread, uint32_t sector)
+{
+	uint32_t n = sector / fat.sectors_per_cluster;
+	uint32_t at = (fread->pos + 511) / 512 / fat.sectors_per_cluster;
+
+	// on along the chain from the cluster it's in, every step is a FAT
+	// sector read unless it's the one already in sect, so going back
+	// follows it from the start
+	if (n < at || fread->cur_cluster >= FAT_EOF) {
+		fread->cur_cluster = fread->f_cluster;
+		at = 0;
+	}
+	for (n -= at; n-- && fread->cur_cluster < FAT_EOF; )
+		fread->cur_cluster = fat_readnext(fread->cur_cluster);
+	fread->sector_offset = sector % fat.sectors_per_cluster;
+	fread->pos = sector * 512;
+}
+
+int read_sector(struct fatread_t * fread, uint8_t * buf)
+{
+	int n;
+
+	if (fread->pos >= fread->size || fread->cur_cluster >= FAT_EOF)
+		return 0;
+	if (readsector(CLUSTER(fread->cur_cluster) + fread->sector_offset, buf))
+		return -1;
+
+	n = (fread->size - fread->pos > 512) ? 512 : fread->size - fread->pos;
+	fread->pos += n;
+
+	if (++fread->sector_offset >= fat.sectors_per_cluster) {
+		fread->sector_offset = 0;
+		fread->cur_cluster = fat_readnext(fread->cur_cluster);
+	}
+
+	return n;
+}
+
+/* calls funct for each entry in the current directory */
+void dir_each(char (*funct)(struct fat32dirent_t*))
+{
+	loop_dir(cur_dir.cluster, funct);
+}
@@ -36,10 +36,19 @@ struct fatwrite_t
 	uint32_t f_cluster;
 	uint32_t cur_cluster;
 	uint32_t dir;
-	uint8_t buf[512];
+	uint8_t * buf;		//sector being filled, 0 borrows the shared directory sector
 	char name[11];
 };
 
+struct fatread_t
+{
+	uint32_t f_cluster;
+	uint32_t cur_cluster;
+	uint32_t size;
+	uint32_t pos;
+	uint8_t sector_offset;
+};
+
 /* the user level functions */
 
 void ls(void);
@@ -52,13 +61,25 @@ void touch(const char * s);
 char mkdir(const char * dirname);
 int dir_highestnumbered(void);
 
-/* routines for writing to files */
+/* routines for writing to files
+ * a file kept open across other file system calls (a photo saved a
+ * packet at a time) needs buf pointed at 512 bytes of its own, one
+ * written from start or append to end in one go can leave it 0
+ */
 
 char write_start(const char * s, struct fatwrite_t * fwrite);
 void write_add(struct fatwrite_t * fwrite, const char * buf, int count);
+void write_add_P(struct fatwrite_t * fwrite, const char * buf, int count);
 void write_end(struct fatwrite_t * fwrite);
 char write_append(const char * s, struct fatwrite_t * fwrite);
 
+/* routines for reading files a sector at a time */
+
+char read_start(const char * s, struct fatread_t * fread);
+int read_sector(struct fatread_t * fread, uint8_t * buf);	//bytes of the file in buf, 0 at the end, -1 on error
+void read_seek(struct fatread_t * fread, uint32_t sector);
+void dir_each(char (*funct)(struct fat32dirent_t*));	//stops early if funct returns 1
+
 /* the workhorse functions */
 
 #define IS_SUBDIR(dirent) (((dirent).attrib & 0x10) && ((dirent).type == DIRENT_FILE))
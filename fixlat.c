@@ -0,0 +1,148 @@
+//////////////////////////////////
+//Fix latency			//
+//sentence to display and card	//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "fixlat.h"
+#include "fat32.h"
+#include "fmt.h"
+
+struct fixlat_stat {
+	uint16_t count;
+	uint16_t min;
+	uint16_t max;
+	uint16_t hist[FIXLAT_BUCKETS];
+};
+
+static struct fixlat_stat fixlat_stats[FIXLAT_STAGES];
+static uint16_t fixlat_skip;
+
+static const char fixlat_n0[] PROGMEM = "parse";
+static const char fixlat_n1[] PROGMEM = "show";
+static const char fixlat_n2[] PROGMEM = "logged";
+static PGM_P const fixlat_names[FIXLAT_STAGES] PROGMEM = {
+	fixlat_n0, fixlat_n1, fixlat_n2
+};
+
+void fixlat_reset(void)
+{
+	uint8_t i;
+
+	memset(fixlat_stats, 0, sizeof(fixlat_stats));
+	for (i=0; i<FIXLAT_STAGES; i++) fixlat_stats[i].min = 0xffff;
+	fixlat_skip = 0;
+}
+
+// 0 and 1 get their own, then 2 3, 4 6, 8 12, 16 24 ...
+static uint8_t fixlat_bucket(uint16_t ms)
+{
+	uint8_t e = 0;
+	uint16_t v;
+
+	if (ms < 2) return ms;
+	for (v = ms; v > 1; v >>= 1) e++;
+	return 2 * e + ((ms >> (e - 1)) & 1);
+}
+
+static uint16_t fixlat_floor(uint8_t b)
+{
+	if (b < 2) return b;
+	return (uint16_t)(2 | (b & 1)) << (b / 2 - 1);
+}
+
+void fixlat_add(uint8_t stage, uint16_t ms)
+{
+	struct fixlat_stat * s = &fixlat_stats[stage];
+	uint8_t b = fixlat_bucket(ms);
+
+	if (s->count != 0xffff) s->count++;
+	if (ms < s->min) s->min = ms;
+	if (ms > s->max) s->max = ms;
+	if (s->hist[b] != 0xffff) s->hist[b]++;
+}
+
+void fixlat_skipped(void)
+{
+	if (fixlat_skip != 0xffff) fixlat_skip++;
+}
+
+uint16_t fixlat_skips(void)
+{
+	return fixlat_skip;
+}
+
+uint16_t fixlat_pct(uint8_t stage, uint8_t pct)
+{
+	struct fixlat_stat * s = &fixlat_stats[stage];
+	uint32_t n = 0, want;
+	uint16_t top;
+	uint8_t b;
+
+	if (!s->count) return 0;
+
+	// the bucket holding the pct'th of the counted fixes
+	want = ((uint32_t)s->count * pct + 99) / 100;
+	for (b=0; b<FIXLAT_BUCKETS - 1; b++) {
+		n += s->hist[b];
+		if (n >= want) break;
+	}
+	if (b == FIXLAT_BUCKETS - 1) return s->max;
+	top = fixlat_floor(b + 1) - 1;
+	return (top < s->max) ? top : s->max;
+}
+
+void fixlat_report(void (*put)(const char * s))
+{
+	static const uint8_t pcts[] PROGMEM = {50, 90, 99};
+	struct fixlat_stat * s;
+	char buf[64], * p;
+	uint8_t i, j;
+
+	fmt_str_P(buf, PSTR("stage count min p50 p90 p99 max (ms)\n"));
+	put(buf);
+	for (i=0; i<FIXLAT_STAGES; i++) {
+		s = &fixlat_stats[i];
+		if (!s->count) continue;
+
+		p = fmt_str_P(buf, (PGM_P)pgm_read_ptr(&fixlat_names[i]));
+		*p++ = ' ';
+		p = fmt_uint(p, s->count);
+		*p++ = ' ';
+		p = fmt_uint(p, s->min);
+		for (j=0; j<sizeof(pcts); j++) {
+			*p++ = ' ';
+			p = fmt_uint(p, fixlat_pct(i, pgm_read_byte(&pcts[j])));
+		}
+		*p++ = ' ';
+		p = fmt_uint(p, s->max);
+		*p++ = '\n';
+		*p = '\0';
+		put(buf);
+	}
+
+	p = fmt_str_P(buf, PSTR("skipped "));
+	p = fmt_uint(p, fixlat_skip);
+	*p++ = '\n';
+	*p = '\0';
+	put(buf);
+}
+
+static struct fatwrite_t * fixlat_file;
+
+static void fixlat_put(const char * s)
+{
+	write_add(fixlat_file, s, strlen(s));
+}
+
+void fixlat_save(const char * name, struct fatwrite_t * fwrite)
+{
+	del(name);
+	touch(name);
+	if (!write_start(name, fwrite)) return;
+	fixlat_file = fwrite;
+	fixlat_report(fixlat_put);
+	write_end(fwrite);
+}
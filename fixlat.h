@@ -0,0 +1,52 @@
+#ifndef FIXLAT_H
+#define FIXLAT_H
+
+#include <inttypes.h>
+
+struct fatwrite_t;
+
+/* fix latency, how long after its sentence finished arriving each fix
+ * got through a stage, and how many fixes were never looked at because
+ * the next one replaced them first
+ */
+
+#define FIXLAT_NAME "fixlat.txt"
+
+/* the stages, names in fixlat.c */
+enum {
+	FIXLAT_PARSE,		//parsed into a gps_location
+	FIXLAT_SHOW,		//on the display
+	FIXLAT_LOGGED,		//log_add() returned, on the card
+	FIXLAT_STAGES
+};
+
+/* histogram buckets, two per power of two ms, the last one is everything
+ * from 48 s up
+ */
+#define FIXLAT_BUCKETS 32
+
+void fixlat_reset(void);
+
+/* ms is the time from the sentence, sched_now() at the stage minus the
+ * sentence's gps_rx_eol
+ */
+void fixlat_add(uint8_t stage, uint16_t ms);
+
+/* a parsed fix was replaced before task_fix() ran */
+void fixlat_skipped(void);
+uint16_t fixlat_skips(void);
+
+/* pct percentile of a stage in ms, the top of its bucket so it errs high,
+ * 0 before anything was added
+ */
+uint16_t fixlat_pct(uint8_t stage, uint8_t pct);
+
+/* a line at a time through put, per stage: count, min, 50/90/99th
+ * percentiles and max, then the skipped fixes
+ */
+void fixlat_report(void (*put)(const char * s));
+
+/* the report as a file in the current directory */
+void fixlat_save(const char * name, struct fatwrite_t * fwrite);
+
+#endif
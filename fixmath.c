@@ -0,0 +1,215 @@
+//////////////////////////////////
+//Fixed point math routines	//
+//CORDIC sine/cosine/atan2 on	//
+//32 bit integers, good to a	//
+//few parts per billion		//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <avr/pgmspace.h>
+#include "fixmath.h"
+
+#define CORDIC_N 30
+#define CORDIC_INVGAIN 652032874	// 1/K = 0.6072529350 in Q2.30
+
+#define FIX_SMALL ((int32_t)1 << 20)	// below this many binary angle units series beat CORDIC
+#define FIX_PI_2 1686629713		// pi/2 in Q2.30
+#define FIX_PI_4 843314857		// pi/4 in Q2.30
+#define FIX_4_PI 1367130551		// 4/pi in Q2.30
+#define FIX_E7_TO_BAM 2562047788UL	// 2^32 / 3.6e9 in Q1.31
+
+/* atan(2^-i) as binary angles with 16 extra fraction bits, so the
+ * rounding of the table doesn't add up over the iterations
+ */
+static const int64_t cordic_atan[CORDIC_N] PROGMEM = {
+	0x200000000000LL, 0x12e4051d9df3LL, 0x09fb385b5ee4LL,
+	0x051111d41ddeLL, 0x028b0d430e59LL, 0x0145d7e15904LL,
+	0x00a2f61e5c28LL, 0x00517c5511d4LL, 0x0028be5346d1LL,
+	0x00145f2ebb31LL, 0x000a2f980092LL, 0x000517cc14a8LL,
+	0x00028be60ce0LL, 0x000145f306c1LL, 0x0000a2f9836bLL,
+	0x0000517cc1b7LL, 0x000028be60dcLL, 0x0000145f306eLL,
+	0x00000a2f9837LL, 0x00000517cc1bLL, 0x0000028be60eLL,
+	0x00000145f307LL, 0x000000a2f983LL, 0x000000517cc2LL,
+	0x00000028be61LL, 0x000000145f30LL, 0x0000000a2f98LL,
+	0x0000000517ccLL, 0x000000028be6LL, 0x0000000145f3LL
+};
+
+/* reads an entry of the atan table */
+static inline int64_t cordic_step(uint8_t i)
+{
+	int64_t a;
+	memcpy_P(&a, &cordic_atan[i], sizeof(a));
+	return a;
+}
+
+/* arithmetic shift right with rounding */
+static inline int32_t shr(int32_t v, uint8_t n)
+{
+	return n ? (v + ((int32_t)1 << (n - 1))) >> n : v;
+}
+
+fix30_t fix_mul(fix30_t a, fix30_t b)
+{
+	return ((int64_t)a * b + ((int64_t)1 << 29)) >> 30;
+}
+
+fix30_t fix_div(fix30_t a, fix30_t b)
+{
+	return ((int64_t)a << 30) / b;
+}
+
+fix30_t fix_sqrt(fix30_t x)
+{
+	uint64_t v = (uint64_t)x << 30;
+	uint64_t r = 0, bit = (uint64_t)1 << 62;
+
+	if (x <= 0) return 0;
+
+	while (bit > v) bit >>= 2;
+
+	// digit by digit integer square root
+	while (bit) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return r;
+}
+
+void fix_sincos(bam_t a, fix30_t * s, fix30_t * c)
+{
+	int32_t x = CORDIC_INVGAIN, y = 0, t;
+	int32_t z = a;
+	int64_t zf;
+	char flip = 0;
+	uint8_t i;
+
+	// small angles, sin(x) = x - x^3/6 and cos(x) = 1 - x^2/2 are exact to the last bit
+	if (z < FIX_SMALL && z > -FIX_SMALL) {
+		x = ((int64_t)z * FIX_PI_2 + ((int64_t)1 << 29)) >> 30;
+		t = fix_mul(x, x);
+		*s = x - fix_mul(x, t) / 6;
+		*c = FIX30_ONE - t / 2;
+		return;
+	}
+
+	// CORDIC converges for [-pi/2, pi/2], rotate anything else by pi
+	if (z > (int32_t)BAM_HALFPI || z < -(int32_t)BAM_HALFPI) {
+		z = (int32_t)(a + BAM_PI);
+		flip = 1;
+	}
+
+	// rotate (1/K, 0) through the angle
+	zf = (int64_t)z << 16;
+	for (i=0; i<CORDIC_N; i++) {
+		t = x;
+		if (zf >= 0) {
+			x -= shr(y, i);
+			y += shr(t, i);
+			zf -= cordic_step(i);
+		} else {
+			x += shr(y, i);
+			y -= shr(t, i);
+			zf += cordic_step(i);
+		}
+	}
+
+	*s = flip ? -y : y;
+	*c = flip ? -x : x;
+}
+
+bam_t fix_atan2(fix30_t y, fix30_t x, fix30_t * r)
+{
+	int32_t z = 0, t, m;
+	int64_t zf;
+	int8_t sh = 0;
+	uint8_t i;
+
+	if (!x && !y) {
+		if (r) *r = 0;
+		return 0;
+	}
+
+	// CORDIC converges for the right half plane, rotate anything else by pi
+	if (x < 0) {
+		x = -x;
+		y = -y;
+		z = BAM_PI;
+	}
+
+	// nearly on the x axis, atan(t) = t - t^3/3 is exact to the last bit
+	if (y < (x >> 10) && y > -(x >> 10)) {
+		t = fix_div(y, x);
+		m = fix_mul(t, t);
+		if (r) *r = x + fix_mul(x, m / 2);
+		return z + fix_rad_to_bam((t - fix_mul(t, m) / 3) >> 1);
+	}
+
+	// normalize so the vector is as long as possible without the CORDIC
+	// gain overflowing, short vectors keep their angular precision this way
+	m = x | (y < 0 ? -y : y);
+	while (m >= ((int32_t)1 << 29)) {
+		m >>= 1;
+		sh--;
+	}
+	while (m < ((int32_t)1 << 28)) {
+		m <<= 1;
+		sh++;
+	}
+	if (sh < 0) {
+		x = shr(x, -sh);
+		y = shr(y, -sh);
+	} else {
+		x <<= sh;
+		y <<= sh;
+	}
+
+	// rotate the vector onto the x axis
+	zf = 0;
+	for (i=0; i<CORDIC_N; i++) {
+		t = x;
+		if (y < 0) {
+			x -= shr(y, i);
+			y += shr(t, i);
+			zf -= cordic_step(i);
+		} else {
+			x += shr(y, i);
+			y -= shr(t, i);
+			zf += cordic_step(i);
+		}
+	}
+
+	if (r) {
+		x = fix_mul(x, CORDIC_INVGAIN);
+		*r = (sh < 0) ? x << -sh : shr(x, sh);
+	}
+
+	return z + (int32_t)((zf + (1 << 15)) >> 16);
+}
+
+rad29_t fix_bam_to_rad(bam_t a)
+{
+	return ((int64_t)(int32_t)a * FIX_PI_4 + ((int64_t)1 << 29)) >> 30;
+}
+
+bam_t fix_rad_to_bam(rad29_t r)
+{
+	return ((int64_t)r * FIX_4_PI + ((int64_t)1 << 29)) >> 30;
+}
+
+bam_t fix_e7_to_bam(int32_t e7)
+{
+	return ((int64_t)e7 * FIX_E7_TO_BAM + ((int64_t)1 << 30)) >> 31;
+}
+
+uint16_t fix_bam_to_cdeg(bam_t a)
+{
+	uint16_t d = ((uint64_t)a * 36000 + ((uint64_t)1 << 31)) >> 32;
+	return (d >= 36000) ? 0 : d;
+}
@@ -0,0 +1,40 @@
+#ifndef FIXMATH_H
+#define FIXMATH_H
+
+#include <inttypes.h>
+
+/* fixed point trig for the AVR, which has no FPU
+ * fix30_t is a signed Q2.30 value (sines, cosines, ratios)
+ * rad29_t is an angle in radians as a signed Q3.29 value
+ * bam_t is a binary angle, a full turn is 2^32 so wraparound is free
+ */
+typedef int32_t fix30_t;
+typedef int32_t rad29_t;
+typedef uint32_t bam_t;
+
+#define FIX30_ONE ((fix30_t)1 << 30)
+#define BAM_PI 0x80000000UL
+#define BAM_HALFPI 0x40000000UL
+
+/* Q2.30 multiply and divide (rounded, 64 bit intermediates) */
+fix30_t fix_mul(fix30_t a, fix30_t b);
+fix30_t fix_div(fix30_t a, fix30_t b);
+
+/* square root of a non-negative Q2.30 value */
+fix30_t fix_sqrt(fix30_t x);
+
+/* sine and cosine of a binary angle using CORDIC */
+void fix_sincos(bam_t a, fix30_t * s, fix30_t * c);
+
+/* angle of the vector (x, y) using CORDIC, also returns the
+ * vector length in r if r is not NULL
+ */
+bam_t fix_atan2(fix30_t y, fix30_t x, fix30_t * r);
+
+/* conversions between angle representations */
+rad29_t fix_bam_to_rad(bam_t a);
+bam_t fix_rad_to_bam(rad29_t r);
+bam_t fix_e7_to_bam(int32_t e7);	//signed degrees * 1e7
+uint16_t fix_bam_to_cdeg(bam_t a);	//0 to 35999 hundredths of a degree
+
+#endif
@@ -0,0 +1,103 @@
+//////////////////////////////////
+//Integer text formatting	//
+//fixed decimals without	//
+//float printf			//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+#include "fmt.h"
+
+/* digits come from subtracting powers of ten, the AVR has no divide */
+static const uint32_t pow10[] PROGMEM = {
+	1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+	10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+char * fmt_str(char * p, const char * s)
+{
+	while (*s)
+		*p++ = *s++;
+	*p = '\0';
+	return p;
+}
+
+char * fmt_str_P(char * p, const char * s)
+{
+	while ((*p = pgm_read_byte(s++)))
+		p++;
+	return p;
+}
+
+/* writes at least min_digits digits, a '.' before the last decimals of them */
+static char * fmt_digits(char * p, uint32_t v, uint8_t min_digits, uint8_t decimals)
+{
+	uint32_t pw;
+	uint8_t i, d, started = 0;
+
+	for (i=0; i<10; i++) {
+		pw = pgm_read_dword(&pow10[i]);
+		for (d='0'; v >= pw; d++)
+			v -= pw;
+		if (d != '0' || 10 - i <= min_digits) started = 1;
+		if (!started) continue;
+		if (decimals && 10 - i == decimals) *p++ = '.';
+		*p++ = d;
+	}
+
+	*p = '\0';
+	return p;
+}
+
+char * fmt_uint(char * p, uint32_t v)
+{
+	return fmt_digits(p, v, 1, 0);
+}
+
+char * fmt_fixed(char * p, int32_t v, uint8_t decimals)
+{
+	uint32_t u = v;
+
+	if (v < 0) {
+		*p++ = '-';
+		u = -u;
+	}
+
+	return fmt_digits(p, u, decimals + 1, decimals);
+}
+
+char * fmt_datetime(char * p, const char * date, const char * time)
+{
+	*p++ = date[2];
+	*p++ = date[3];
+	*p++ = '/';
+	*p++ = date[0];
+	*p++ = date[1];
+	*p++ = '/';
+	*p++ = date[4];
+	*p++ = date[5];
+	*p++ = ' ';
+	*p++ = time[0];
+	*p++ = time[1];
+	*p++ = ':';
+	*p++ = time[2];
+	*p++ = time[3];
+	*p++ = ':';
+	*p++ = time[4];
+	*p++ = time[5];
+
+	return fmt_str(p, " GMT");
+}
+
+uint8_t fmt_two_digits(const char * s)
+{
+	return (s[0] - '0') * 10 + (s[1] - '0');
+}
+
+uint8_t fmt_hex_digit(int c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return 0xff;
+}
@@ -0,0 +1,32 @@
+#ifndef FMT_H
+#define FMT_H
+
+#include <inttypes.h>
+
+/* integer only text formatting, so the logger doesn't need the float
+ * printf library
+ * each routine writes at p, NUL terminates and returns the new end so
+ * calls can be chained into one buffer
+ */
+
+char * fmt_str(char * p, const char * s);
+
+/* fmt_str from program memory, use with PSTR() */
+char * fmt_str_P(char * p, const char * s);
+
+/* unsigned decimal */
+char * fmt_uint(char * p, uint32_t v);
+
+/* signed value with a fixed number of decimals, fmt_fixed(p, -1234, 2) is "-12.34" */
+char * fmt_fixed(char * p, int32_t v, uint8_t decimals);
+
+/* NMEA ddmmyy and hhmmss.sss as "mm/dd/yy hh:mm:ss GMT" */
+char * fmt_datetime(char * p, const char * date, const char * time);
+
+/* the other way, the value of two ASCII digits such as the hours of an NMEA time */
+uint8_t fmt_two_digits(const char * s);
+
+/* the value of one hex digit, either case, 0xff if c isn't one */
+uint8_t fmt_hex_digit(int c);
+
+#endif
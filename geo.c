@@ -0,0 +1,158 @@
+//////////////////////////////////
+//Geodesic displacement between	//
+//two GPS fixes, built on the	//
+//fixed point trig in fixmath	//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <stddef.h>
+#include "fixmath.h"
+#include "geo.h"
+
+#define ITERATIONS 64
+
+#define GEO_F 3600053		// flattening of WGS-84, 1/298.257223563
+#define GEO_1MF 1070141771	// 1 - f
+#define GEO_F_4 900013		// f / 4
+#define GEO_EP2 7236480		// (a^2 - b^2) / b^2
+#define GEO_B_CM 635675231LL	// semi-minor axis, centimeters
+#define GEO_R_CM 637100880LL	// mean earth radius, centimeters
+#define GEO_E7_TO_CM 72954	// 1.11319 cm per 1e-7 degree of latitude, Q16
+
+#define FIX(n, d) ((fix30_t)(((int64_t)(n) << 30) / (d)))
+
+/* reduced latitude atan((1 - f) * tan(lat)) with its sine and cosine */
+static bam_t reduced_lat(int32_t lat, fix30_t * s, fix30_t * c)
+{
+	fix30_t sl, cl;
+	bam_t u;
+	fix_sincos(fix_e7_to_bam(lat), &sl, &cl);
+	u = fix_atan2(fix_mul(GEO_1MF, sl), cl, NULL);
+	fix_sincos(u, s, c);
+	return u;
+}
+
+/* a + b * (1 - cos(lambda)) from h = sin^2(lambda / 2), 1 - cos(lambda)
+ * itself reaches 2 near the antimeridian and doesn't fit in Q2.30, the
+ * sum always does
+ */
+static fix30_t add_hav(fix30_t a, fix30_t b, fix30_t h)
+{
+	return a + 2 * (int64_t)fix_mul(b, h);
+}
+
+/* distance in centimeters of an arc in radians on a sphere of radius r_cm */
+static uint32_t arc_cm(rad29_t arc, int64_t r_cm)
+{
+	return (arc * r_cm + ((int64_t)1 << 28)) >> 29;
+}
+
+char geo_vincenty(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2, struct geo_disp * gd)
+{
+	fix30_t s1, c1, s2, c2;
+	fix30_t sdu, cdu, shl, h, sl, cl, ss, cs, sa, csqa, c2sm, C, t2, usq, A, B, ds;
+	bam_t u1, u2, L, lambda, ltemp, sigma;
+	rad29_t inner;
+	uint8_t lim = 0;
+
+	u1 = reduced_lat(lat1, &s1, &c1);
+	u2 = reduced_lat(lat2, &s2, &c2);
+	fix_sincos(u2 - u1, &sdu, &cdu);
+
+	fix30_t s1s2 = fix_mul(s1, s2);
+	fix30_t c1c2 = fix_mul(c1, c2);
+	fix30_t s1c2 = fix_mul(s1, c2);
+	fix30_t c1s2 = fix_mul(c1, s2);
+
+	L = fix_e7_to_bam(lon2) - fix_e7_to_bam(lon1);	//difference in longitude, wraps for free
+	lambda = L;
+
+	do {
+		lim++;
+		fix_sincos(lambda, &sl, &cl);
+		fix_sincos((int32_t)lambda >> 1, &shl, &cl);
+		h = fix_mul(shl, shl);						//(1 - cos(lambda)) / 2 without the cancellation
+
+		// c1 * s2 - s1 * c2 * cos(lambda) and s1 * s2 + c1 * c2 * cos(lambda), rewritten
+		// around sin(u2 - u1) and cos(u2 - u1) so nearby fixes don't cancel out
+		fix_atan2(add_hav(sdu, s1c2, h), fix_mul(c2, sl), &ss);		//sin(sigma), as a vector length so short lines keep their precision
+		cs = add_hav(cdu, -c1c2, h);					//cos(sigma)
+
+		// coincident points
+		if (!ss) {
+			gd->dist = 0;
+			gd->bearing1 = gd->bearing2 = 0;
+			gd->iterations = lim;
+			return 0;
+		}
+
+		sigma = fix_atan2(ss, cs, NULL);
+		sa = fix_div(fix_mul(c1c2, sl), ss);				//sin(alpha)
+		csqa = FIX30_ONE - fix_mul(sa, sa);				//cos_squared(alpha)
+		c2sm = csqa ? cs - 2 * fix_div(s1s2, csqa) : 0;			//cos(2sigma_m), 0 on the equator
+		C = fix_mul(fix_mul(GEO_F_4, csqa), FIX30_ONE + fix_mul(GEO_F, FIX30_ONE - fix_mul(csqa, FIX(3, 4))));
+		t2 = 2 * (fix_mul(c2sm, c2sm) - FIX(1, 2));			//-1 + 2 * cos^2(2sigma_m)
+
+		inner = fix_bam_to_rad(sigma) + (fix_mul(fix_mul(C, ss), c2sm + fix_mul(C, fix_mul(cs, t2))) >> 1);
+		ltemp = lambda;
+		lambda = L + fix_rad_to_bam(fix_mul(fix_mul(FIX30_ONE - C, GEO_F), fix_mul(sa, inner)));
+	} while (((int32_t)(lambda - ltemp) > 2 || (int32_t)(lambda - ltemp) < -2) && lim < ITERATIONS);	//check for accuracy or too many iterations, rounding can keep it swinging by 2
+
+	usq = fix_mul(csqa, GEO_EP2);					//u squared
+	A = FIX30_ONE + fix_mul(usq, FIX(1, 4) + fix_mul(usq, -FIX(3, 64) + fix_mul(usq, FIX(5, 256) - fix_mul(usq, FIX(175, 16384)))));
+	B = fix_mul(usq, FIX(1, 4) + fix_mul(usq, -FIX(1, 8) + fix_mul(usq, FIX(74, 1024) - fix_mul(usq, FIX(47, 1024)))));
+
+	// delta sigma, (-3 + 4x^2) factors are carried as 4 * (x^2 - 3/4) to stay in range
+	ds = fix_mul(fix_mul(fix_mul(B, c2sm), fix_mul(fix_mul(ss, ss) - FIX(3, 4), fix_mul(c2sm, c2sm) - FIX(3, 4))) * 8, FIX(1, 3));
+	ds = fix_mul(fix_mul(B, ss), c2sm + (fix_mul(B, fix_mul(cs, t2) - ds) >> 2));
+
+	gd->dist = ((int64_t)arc_cm(fix_bam_to_rad(sigma) - (ds >> 1), GEO_B_CM) * A + ((int64_t)1 << 29)) >> 30;
+
+	// bearings, binary angles are always positive
+	fix_sincos(lambda, &sl, &cl);
+	fix_sincos((int32_t)lambda >> 1, &shl, &cl);
+	h = fix_mul(shl, shl);
+	gd->bearing1 = fix_bam_to_cdeg(fix_atan2(fix_mul(c2, sl), add_hav(sdu, s1c2, h), NULL));
+	gd->bearing2 = fix_bam_to_cdeg(fix_atan2(fix_mul(c1, sl), add_hav(sdu, -c1s2, h), NULL));
+	gd->iterations = lim;
+
+	return lim >= ITERATIONS;
+}
+
+void geo_haversine(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2, struct geo_disp * gd)
+{
+	fix30_t s1, c1, s2, c2, sdlat, sdlon, sl, cl, h, t;
+	bam_t phi1 = fix_e7_to_bam(lat1);
+	bam_t phi2 = fix_e7_to_bam(lat2);
+	bam_t dlon = fix_e7_to_bam(lon2) - fix_e7_to_bam(lon1);
+
+	fix_sincos(phi1, &s1, &c1);
+	fix_sincos(phi2, &s2, &c2);
+	fix_sincos((int32_t)(phi2 - phi1) >> 1, &sdlat, &t);
+	fix_sincos((int32_t)dlon >> 1, &sdlon, &t);
+
+	// sqrt of the haversine, taken as a vector length to avoid squaring small values,
+	// the square roots go first so cos(lat) near the poles keeps its precision
+	fix_atan2(fix_mul(fix_mul(fix_sqrt(c1), fix_sqrt(c2)), sdlon), sdlat, &h);
+	if (h > FIX30_ONE) h = FIX30_ONE;
+
+	gd->dist = arc_cm(fix_bam_to_rad(fix_atan2(h, fix_sqrt(FIX30_ONE - fix_mul(h, h)), NULL)), 2 * GEO_R_CM);
+
+	fix_sincos(dlon, &sl, &cl);
+	gd->bearing1 = fix_bam_to_cdeg(fix_atan2(fix_mul(sl, c2), fix_mul(c1, s2) - fix_mul(fix_mul(s1, c2), cl), NULL));
+	gd->bearing2 = fix_bam_to_cdeg(fix_atan2(fix_mul(sl, c1), fix_mul(fix_mul(s2, c1), cl) - fix_mul(c2, s1), NULL));
+	gd->iterations = 0;
+}
+
+int32_t geo_coslat(int32_t lat)
+{
+	fix30_t s, c;
+	fix_sincos(fix_e7_to_bam(lat), &s, &c);
+	return c;
+}
+
+void geo_offset_cm(int32_t lat0, int32_t lon0, int32_t coslat, int32_t lat, int32_t lon, int32_t * x, int32_t * y)
+{
+	*y = ((int64_t)(lat - lat0) * GEO_E7_TO_CM) >> 16;
+	*x = ((((int64_t)(lon - lon0) * GEO_E7_TO_CM) >> 16) * coslat) >> 30;
+}
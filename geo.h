@@ -0,0 +1,33 @@
+#ifndef GEO_H
+#define GEO_H
+
+#include <inttypes.h>
+
+/* geodesic between two points, all integer */
+struct geo_disp {
+	uint32_t dist;		//distance in centimeters
+	uint16_t bearing1;	//initial bearing, degrees * 100
+	uint16_t bearing2;	//final bearing, degrees * 100
+	uint8_t iterations;	//vincenty iterations used
+};
+
+/* Vincenty inverse formula on the WGS-84 ellipsoid using fixed point
+ * trig, coordinates are signed degrees * 1e7
+ * returns 0, or 1 if the iteration did not converge (nearly antipodal)
+ */
+char geo_vincenty(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2, struct geo_disp * gd);
+
+/* great circle distance on a spherical earth, cheaper than vincenty
+ * and within about 0.5% of it
+ */
+void geo_haversine(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2, struct geo_disp * gd);
+
+/* cos(lat) in Q2.30 for geo_offset_cm, kept with the reference point */
+int32_t geo_coslat(int32_t lat);
+
+/* east (x) and north (y) centimeters from a reference point to lat, lon
+ * on a flat earth, which is plenty over a few hundred meters
+ */
+void geo_offset_cm(int32_t lat0, int32_t lon0, int32_t coslat, int32_t lat, int32_t lon, int32_t * x, int32_t * y);
+
+#endif
@@ -8,17 +8,19 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <avr/pgmspace.h>
 #include "gps.h"
-#include <math.h>
-#include <stdlib.h>
+#include "prof.h"
+#include "iostat.h"
 #include "lcd.h"
 #include "fat32.h"
 #include "serialgps.h"
+#include "geo.h"
+#include "trklog.h"
+#include "fmt.h"
 
 #define KML_NAME "log.kml"
 #define PLENGTH 16
-#define ITERATIONS 64
-#define sq(a) ((a)*(a))
 
 char gps_calcchecksum(const char * s)
 {
@@ -31,6 +33,41 @@ char gps_calcchecksum(const char * s)
 	return c;
 }
 
+/* parses a lattitude (ddmm.mmmm) or longitude (dddmm.mmmm) into
+ * unsigned degrees * 1e7 without going through floating point
+ */
+static int32_t dm_to_e7(const char * s)
+{
+	uint32_t dm = 0, frac = 0, scale = 1000000;
+
+	while (*s >= '0' && *s <= '9')
+		dm = dm * 10 + *s++ - '0';
+	if (*s == '.') s++;
+	while (*s >= '0' && *s <= '9' && scale > 1) {
+		scale /= 10;
+		frac += (*s++ - '0') * scale;
+	}
+
+	// degrees plus minutes * 1e6 / 60 * 10, rounded
+	return (dm / 100) * 10000000L + ((dm % 100) * 1000000L + frac + 3) / 6;
+}
+
+/* parses a decimal number into an integer with a fixed number of decimals */
+static uint32_t parse_fixed(const char * s, uint8_t decimals)
+{
+	uint32_t n = 0;
+
+	while (*s >= '0' && *s <= '9')
+		n = n * 10 + *s++ - '0';
+	if (*s == '.') s++;
+	while (decimals--) {
+		n *= 10;
+		if (*s >= '0' && *s <= '9') n += *s++ - '0';
+	}
+
+	return n;
+}
+
 /* Routine to fill raw GPS data into a gps_location struct */
 int gps_log_data(char * data, struct gps_location * loc)
 {
@@ -39,12 +76,14 @@ int gps_log_data(char * data, struct gps_location * loc)
 	int field = 0;
 	char temp[PLENGTH];
 	char done_flag = 0;
+	PROF_SCOPE(PROF_LOG_DATA);
 	
 	while (!done_flag) {			//while still in the string
 		while (data[i] != ',') {	//field by field in a comma separated file
-			temp[j] = data[i];	//copy to temp
+			if (!data[i]) return -1;	//ran out of fields
+			if (j < PLENGTH - 1)	//copy to temp, cut short if it's too long
+				temp[j++] = data[i];
 			i++;
-			j++;
 		}
 		temp[j] = '\0';
 		j = 0;
@@ -52,8 +91,7 @@ int gps_log_data(char * data, struct gps_location * loc)
 		
 		switch (field) {
 			case 0:			//error checking, return -1 if wrong data
-				//if (strncmp("$GPRMC", temp, 6)) {lcd_print(" k"); return -1;}
-				if (temp[1] != 'G') return -1;
+				if (strncmp_P(temp, PSTR("$GPRMC"), 6)) return -1;	//other sentences may be enabled (see gpsconf.c)
 				break;
 			case 1:			//then fill in all the fields of the gps location
 				strcpy(loc->time, temp);
@@ -62,22 +100,22 @@ int gps_log_data(char * data, struct gps_location * loc)
 				loc->status = *temp;
 				break;
 			case 3:
-				loc->lat = atof(temp);
+				loc->ilat = dm_to_e7(temp);
 				break;
 			case 4:
-				loc->ns = *temp;
+				if (*temp == 'S') loc->ilat = -loc->ilat;
 				break;
 			case 5:
-				loc->lon = atof(temp);
+				loc->ilon = dm_to_e7(temp);
 				break;
 			case 6:
-				loc->ew = *temp;
+				if (*temp == 'W') loc->ilon = -loc->ilon;
 				break;
-			case 7:
-				loc->sog = atof(temp);
+			case 7:			//knots * 1000 to cm/s
+				loc->isog = (parse_fixed(temp, 3) * 463 + 4500) / 9000;
 				break;
 			case 8:
-				loc->cog = atof(temp);
+				loc->icog = parse_fixed(temp, 2);
 				break;
 			case 9:
 				strcpy(loc->date, temp);
@@ -93,158 +131,148 @@ int gps_log_data(char * data, struct gps_location * loc)
 
 
 
-/* --------------------------------------------------------------- */
-/* Routine for calculating GPS displacement down to 0.5mm accuracy */
-/* --------------------------------------------------------------- */
+/* ------------------------------------------------------------ */
+/* Routine for calculating GPS displacement, see geo.c for math */
+/* ------------------------------------------------------------ */
 
 int gps_calc_disp(struct gps_location * gl1, struct gps_location * gl2, struct gps_displacement * gd)
 {
-	double lat1 = dm_to_dd(gl1->lat, gl1->ns);
-	double lon1 = dm_to_dd(gl1->lon, gl1->ew);
-	double lat2 = dm_to_dd(gl2->lat, gl2->ns);
-	double lon2 = dm_to_dd(gl2->lon, gl2->ew);
-	
-	double a = 6378137;
-	double b = 6356752.3142;
-	double f = 1/298.257223563;		//flatening of geoid;
-	double L = (lon2 - lon1) * M_PI / 180;	//difference in longitude in radians
-	double s1 = sin(atan((1 - f) * tan(lat1 * M_PI / 180)));	//sin of reduced lat1
-	double c1 = cos(atan((1 - f) * tan(lat1 * M_PI / 180)));	//cos of reduced lon1
-	double s2 = sin(atan((1 - f) * tan(lat2 * M_PI / 180)));	//sin of reduced lat2
-	double c2 = cos(atan((1 - f) * tan(lat2 * M_PI / 180)));	//cos of reduced lon2
-	
-	double lambda = L;
-	double ltemp, sigma, ss /*sin(sigma)*/, cs /*cos(sigma)*/, sa /*sin(alpha), ca cos(alpha)*/, csqa /*cos^2(alpha(*/, c2sm /*cos(2sigma sub m)*/, C, usq /*u^2*/, A, B, ds /*delta(sigma)*/;
-	int8_t lim = 0;
-	
-	do {	
-		lim++;
-		ss = sqrt(sq(c2 * sin(lambda)) + sq(c1 * s2 - s1 * c2 * cos(lambda)));	//sin(sigma)
-		cs = s1 * s2 + c1 * c2 * cos(lambda);			//cos(sigma)
-		sigma = atan2(ss , cs);
-		sa = c1 * c2 * sin(lambda) / ss;			//sin(alpha)
-		csqa = 1 - sq(sa);					//cos_squared(alpha)
-		c2sm = cs - 2 * s1 * s2 / csqa;				//cos(2sigma_m)
-		C = f / 16 * csqa * (4 + f * (4 - 3 * csqa));		//intermediate value
-		ltemp = lambda;						//store old value of lambda
-		lambda = L + (1 - C) * f * sa * (sigma + C * ss * (c2sm + C * cs * (-1 + 2 * sq(c2sm))));	//get new value
-		//lcd_printf("ltemp: %d\nlambda: %d",(int)ltemp,(int)lambda);
-		//printf("ltemp: %f\nlambda: %f\niterations: %d\n",ltemp,lambda,lim);
-	} while ((((lambda - ltemp) > 1e-12) || ((ltemp - lambda) > 1e-12)) && lim < ITERATIONS);	//check for accuracy or too many iterations
-
-	usq = csqa * (sq(a) - sq(b)) / sq(b);				//u squared
-	A = 1 + usq / 16384 * (4096 + usq * (-768 + usq * (320 - 175 * usq)));	//intermediate value
-	B = usq / 1024 * (256 + usq * (-128 + usq * (74 - 47 * usq)));	//intermediate value
-	ds = B * ss * (c2sm + B / 4 * (cs * (-1 + 2 * sq(c2sm)) - B / 6 * c2sm * (-3 + 4 * sq(ss)) * (-3 + 4 * sq(c2sm)))); //delta sigma
-	
-	gd->magnitude = b * A * (sigma - ds);				//displacement magnitude
-	gd->initial_bearing = atan2(c2 * sin(lambda) , c1 * s2 - s1 * c2 * cos(lambda)) * 180. / M_PI;	//displacement initial bearing	
-	gd->final_bearing = atan2(c1 * sin(lambda) , -s1 * c2 + c1 * s2 * cos(lambda)) * 180. / M_PI;		//displacement final bearing
-	gd->iterations = lim;
-	
-	// make the bearings always positive
-	if (gd->initial_bearing < 0) gd->initial_bearing += 360.;
-	if (gd->final_bearing < 0) gd->final_bearing += 360.;
-	
-	return 0;
-}
-
-double dm_to_dd(double dm, char nsew)
-{
-	double dd = floor(dm/100);		//get rid of minutes
-	double mm = (dm - dd * 100) / 60;	//get rid of degrees and convert to decimal deg
-	//printf("dm: %f dd: %f mm: %f mm + dd: %f\n",dm,dd,mm,mm+dd);
-	return (mm + dd) * ((nsew == 'W' || nsew == 'S') ? -1 : 1);			//add em up and return
-}
-
+	PROF_SCOPE(PROF_CALC_DISP);
+	struct geo_disp g;
+	char r = geo_vincenty(gl1->ilat, gl1->ilon, gl2->ilat, gl2->ilon, &g);
 
+	gd->magnitude = g.dist;
+	gd->initial_bearing = g.bearing1;
+	gd->final_bearing = g.bearing2;
+	gd->iterations = g.iterations;
 
+	return r;
+}
 
 /* ---------------------------------------------------- */
 /* Routines for logging gps data in KML formatted files */
 /* ---------------------------------------------------- */
 
-const char map_start[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<kml xmlns=\"http://earth.google.com/kml/2.0\">\n<Document>\n<name>Trailview Path</name>\n";
-const char map_end[] = "</Document>\n</kml>";
-const char map_pointstart[] = "<Placemark>\n<description><![CDATA[";
-const char map_pointmiddle[] = "]]></description>\n<name>";
-const char map_pointname[] = "</name>\n<Point>\n<coordinates>";
-const char map_pointend[] = "</coordinates>\n</Point>\n</Placemark>\n\n";
+static struct trk_state trk;
+
+#if LOG_KML
+const char map_start[] PROGMEM = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<kml xmlns=\"http://earth.google.com/kml/2.0\">\n<Document>\n<name>Trailview Path</name>\n";
+const char map_end[] PROGMEM = "</Document>\n</kml>";
+const char map_pointstart[] PROGMEM = "<Placemark>\n<description><![CDATA[";
+const char map_pointmiddle[] PROGMEM = "]]></description>\n<name>";
+const char map_pointname[] PROGMEM = "</name>\n<Point>\n<coordinates>";
+const char map_pointend[] PROGMEM = "</coordinates>\n</Point>\n</Placemark>\n\n";
+const char kml_urlstart[] PROGMEM = "<img src=\"";
+const char kml_urlend[] PROGMEM = "\" width=\"200\">";
+#endif
 
 void log_start(struct fatwrite_t * fwrite)
 {
 	char name[13];
 	int log_num;
+	IOSTAT_SCOPE(IOSTAT_LOG_START);
 
 	// generate a unique name
 	log_num = dir_highestnumbered() + 1;
-	snprintf(name, 13, "%d", log_num);
+	snprintf_P(name, 13, PSTR("%d"), log_num);
 
-	lcd_printf("log: #%d\nstarting...", log_num);
+	lcd_printf_P(PSTR("log: #%d\nstarting..."), log_num);
 
 	if (mkdir(name)) {
-		lcd_printf("log: error\nname not unique");
+		lcd_printf_P(PSTR("log: error\nname not unique"));
 		while (1) ;
 	}
 
 	cd(name);
 
+	trk_start(&trk, fwrite);
+
+#if LOG_KML
 	// create file
 	del(KML_NAME);
 	touch(KML_NAME);
 
 	write_start(KML_NAME, fwrite);
-	write_add(fwrite, map_start, sizeof(map_start)-1);
+	write_add_P(fwrite, map_start, sizeof(map_start)-1);
 	write_end(fwrite);
+#endif
 }
 
 void log_end(struct fatwrite_t * fwrite)
 {
+#if LOG_KML
 	write_append(KML_NAME, fwrite);
-	write_add(fwrite, map_end, sizeof(map_end)-1);
+	write_add_P(fwrite, map_end, sizeof(map_end)-1);
 	write_end(fwrite);
+#endif
 	cd("..");
 }
 
-const char kml_urlstart[] = "<img src=\"";
-const char kml_urlend[] = "\" width=\"200\">";
-
-void log_add(struct fatwrite_t * fwrite, struct gps_location * gl, struct gps_displacement * gd, const char * img_name)
+#if LOG_KML
+static void log_kml(struct fatwrite_t * fwrite, struct gps_location * gl, struct gps_displacement * gd, const char * img_name)
 {
-	char buf[64];
+	char buf[64], * p;
 
 	write_append(KML_NAME, fwrite);
-	write_add(fwrite, map_pointstart, sizeof(map_pointstart)-1);
+	write_add_P(fwrite, map_pointstart, sizeof(map_pointstart)-1);
 	
 	// add data
-	snprintf(buf, 64, "Speed: %.2fm/s<br><br>", gl->sog);
-	write_add(fwrite, buf, strlen(buf));
-	snprintf(buf, 64, "<u>From Start:</u><br>Displacement: %dm<br>", (int)gd->magnitude);
-	write_add(fwrite, buf, strlen(buf));
-	snprintf(buf, 64, "Initial: %d&deg;&nbsp;&nbsp;", (int)gd->initial_bearing);
-	write_add(fwrite, buf, strlen(buf));
-	snprintf(buf, 64, "Final: %d&deg;<br>", (int)gd->final_bearing);
-	write_add(fwrite, buf, strlen(buf));
-	write_add(fwrite, kml_urlstart, sizeof(kml_urlstart)-1);
-	write_add(fwrite, img_name, strlen(img_name));
-	write_add(fwrite, kml_urlend, sizeof(kml_urlend)-1);
-	write_add(fwrite, map_pointmiddle, sizeof(map_pointmiddle)-1);
+	p = fmt_str_P(buf, PSTR("Speed: "));
+	p = fmt_fixed(p, gl->isog, 2);
+	p = fmt_str_P(p, PSTR("m/s<br><br>"));
+	write_add(fwrite, buf, p - buf);
+	p = fmt_str_P(buf, PSTR("<u>From Start:</u><br>Displacement: "));
+	p = fmt_uint(p, gd->magnitude / 100);
+	p = fmt_str_P(p, PSTR("m<br>"));
+	write_add(fwrite, buf, p - buf);
+	p = fmt_str_P(buf, PSTR("Initial: "));
+	p = fmt_uint(p, gd->initial_bearing / 100);
+	p = fmt_str_P(p, PSTR("&deg;&nbsp;&nbsp;Final: "));
+	p = fmt_uint(p, gd->final_bearing / 100);
+	p = fmt_str_P(p, PSTR("&deg;<br>"));
+	write_add(fwrite, buf, p - buf);
+	if (img_name) {
+		write_add_P(fwrite, kml_urlstart, sizeof(kml_urlstart)-1);
+		write_add(fwrite, img_name, strlen(img_name));
+		write_add_P(fwrite, kml_urlend, sizeof(kml_urlend)-1);
+	}
+	write_add_P(fwrite, map_pointmiddle, sizeof(map_pointmiddle)-1);
 	
-	// add time
 	// add date and time
-	snprintf(buf, 64, "%c%c/%c%c/%c%c %c%c:%c%c:%c%c GMT",
-			gl->date[2], gl->date[3], gl->date[0], gl->date[1], gl->date[4], gl->date[5],
-			gl->time[0], gl->time[1], gl->time[2], gl->time[3], gl->time[4], gl->time[5]);	
-	write_add(fwrite, buf, strlen(buf));
-	write_add(fwrite, map_pointname, sizeof(map_pointname)-1);
+	p = fmt_datetime(buf, gl->date, gl->time);
+	write_add(fwrite, buf, p - buf);
+	write_add_P(fwrite, map_pointname, sizeof(map_pointname)-1);
 
 	// add coordinates
-	snprintf(buf, 64, "%.7f,%.7f", dm_to_dd(gl->lon, gl->ew), dm_to_dd(gl->lat, gl->ns));
-	write_add(fwrite, buf, strlen(buf));
+	p = fmt_fixed(buf, gl->ilon, 7);
+	*p++ = ',';
+	p = fmt_fixed(p, gl->ilat, 7);
+	write_add(fwrite, buf, p - buf);
 	
-	write_add(fwrite, map_pointend, sizeof(map_pointend)-1);
+	write_add_P(fwrite, map_pointend, sizeof(map_pointend)-1);
 	write_end(fwrite);
 }
+#endif
+
+void log_add(struct fatwrite_t * fwrite, struct gps_location * gl, struct gps_displacement * gd, unsigned int img)
+{
+	struct trk_record r;
+	IOSTAT_SCOPE(IOSTAT_LOG_ADD);
+
+	r.time = trk_time(gl->date, gl->time);
+	r.lat = gl->ilat;
+	r.lon = gl->ilon;
+	r.sog = gl->isog;
+	r.cog = gl->icog;
+	r.dist = gd->magnitude;
+	r.bearing = gd->initial_bearing;
+	r.photo = img;
+	trk_add(&trk, fwrite, &r);
+
+#if LOG_KML
+	log_kml(fwrite, gl, gd, (img == TRK_NOPHOTO) ? 0 : gps_gen_name(img));
+#endif
+}
 
 const char * gps_gen_name(unsigned int n)
 {
@@ -263,15 +291,3 @@ const char * gps_gen_name(unsigned int n)
 	
 	return buf + i + 1;
 }
-
-void gps_disable_unwanted(void)
-{
-	// $PSRF103,<msg>,<mode>,<rate>,<cksumEn>*CKSUM<CR><LF>
-	send_gps("$PSRF103,00,00,00,01*");
-	send_gps("$PSRF103,01,00,00,01*");
-	send_gps("$PSRF103,02,00,00,01*");
-	send_gps("$PSRF103,03,00,00,01*");
-	send_gps("$PSRF103,04,00,01,01*");
-	send_gps("$PSRF103,05,00,00,01*");
-}
-
@@ -7,20 +7,17 @@
 struct gps_location {
 	char time[16];		//time of GPS data query hhmmss.sss
 	char status;		//A=valid V=invalid
-	double lat;		//lattitude ddmm.mmmm
-	char ns;		//'N'=north 'S'=south
-	double lon;		//longintude dddmm.mmmm
-	char ew;		//'E'=east 'W'=west
-	double sog;		//speed over ground knots
-	double cog;		//course over ground degrees 
+	int32_t ilat;		//lattitude signed degrees * 1e7, north positive
+	int32_t ilon;		//longitude signed degrees * 1e7, east positive
+	uint16_t isog;		//speed over ground cm/s
+	uint16_t icog;		//course over ground degrees * 100
 	char date[16];		//ddmmyy
 };
 
 struct gps_displacement {
-	double magnitude;
-	double initial_bearing;
-	double final_bearing;
-	double speed;
+	uint32_t magnitude;		//centimeters
+	uint16_t initial_bearing;	//degrees * 100
+	uint16_t final_bearing;		//degrees * 100
 	char iterations;
 };
 
@@ -35,22 +32,22 @@ int gps_log_data(char * data, struct gps_location* loc);
 
 /*This function takes the latitudes and longitudes
  *of two GPS locations and returns the displacement
- *using the Vincenty formula, accurate to .5 mm
+ *using the Vincenty formula in fixed point, accurate
+ *to about 10 cm (better than the GPS resolution)
  */
 int gps_calc_disp(struct gps_location * gl1, struct gps_location * gl2, struct gps_displacement * gd);
 
-/*This function converts a lattitude (ddmm.mmmm)
- *or longitude dddmm.mmmm to decimal degrees
+/* For logging, every session gets a numbered directory with a binary
+ * track.bin (see trklog.h) and, if LOG_KML is set, a log.kml as well
  */
-double dm_to_dd(double dm, char nsew);	//lat ddmm.mmmm and lon dddmm.mmmm to decimal degrees
-
-/* disables the sending of GPS data we don't need (set rate to 0) */
-void gps_disable_unwanted(void);
+#ifndef LOG_KML
+#define LOG_KML 0
+#endif
 
-/* For logging KML data */
 void log_start(struct fatwrite_t * fwrite);
 void log_end(struct fatwrite_t * fwrite);
-void log_add(struct fatwrite_t * fwrite, struct gps_location * gl, struct gps_displacement * gd, const char * img_name);
+/* img is the photo number, or TRK_NOPHOTO if the photo failed */
+void log_add(struct fatwrite_t * fwrite, struct gps_location * gl, struct gps_displacement * gd, unsigned int img);
 const char * gps_gen_name(unsigned int n);
 
 #endif
@@ -0,0 +1,158 @@
+//////////////////////////////////
+//GPS receiver configuration	//
+//baud rate and NMEA output	//
+//rates for the SiRF receiver	//
+//////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "gps.h"
+#include "gpsconf.h"
+#include "lcd.h"
+#include "serialgps.h"
+#include "sirf.h"
+#include "fmt.h"
+
+#define GPS_DEFAULT_BAUD 4800
+
+/* USART0 divisors at 8 MHz with U2X set, all within 2.1% */
+struct gps_baud {
+	uint16_t baud;
+	uint8_t ubrr;
+};
+
+static const struct gps_baud gps_bauds[] PROGMEM = {
+	{4800, 207},
+	{9600, 103},
+	{19200, 51},
+	{38400, 25},
+	{57600, 16}
+};
+
+char gps_receive_valid(char * buf, int len, unsigned int ms)
+{
+	int c, i = 0;
+	uint8_t hi, lo;
+
+	// wait for the start of a sentence
+	do {
+		if ((c = receive_char_timeout(ms)) < 0) return -1;
+	} while (c != '$');
+
+	// read up to the checksum
+	while (c != '*') {
+		if (i >= len - 1) return 1;
+		buf[i++] = c;
+		if ((c = receive_char_timeout(ms)) < 0) return -1;
+	}
+	buf[i] = '\0';
+
+	// compare checksums
+	if ((c = receive_char_timeout(ms)) < 0) return -1;
+	hi = fmt_hex_digit(c);
+	if ((c = receive_char_timeout(ms)) < 0) return -1;
+	lo = fmt_hex_digit(c);
+
+	return ((char)((hi << 4) | lo) == gps_calcchecksum(buf)) ? 0 : 1;
+}
+
+void gps_set_rates(uint8_t rmc, uint8_t gga)
+{
+	char buf[32];
+	uint8_t msg, rate;
+
+	// $PSRF103,<msg>,<mode>,<rate>,<cksumEn>*CKSUM<CR><LF>
+	for (msg=GPS_MSG_GGA; msg<=GPS_MSG_VTG; msg++) {
+		rate = (msg == GPS_MSG_RMC) ? rmc : (msg == GPS_MSG_GGA) ? gga : 0;
+		snprintf_P(buf, sizeof(buf), PSTR("$PSRF103,%02d,00,%02d,01*"), msg, rate);
+		send_gps(buf);
+	}
+}
+
+/* listens at the current baud for the sentences we asked for */
+static char gps_verify(const struct gps_config * cfg)
+{
+	char buf[GPS_SENTENCE];
+	uint8_t rmc = 0, gga = 0, tries = 20;
+	uint8_t period = (cfg->rmc_period > cfg->gga_period) ? cfg->rmc_period : cfg->gga_period;
+
+	// binary, two good geodetic frames
+	if (cfg->binary) {
+		struct sirf_parser p;
+		struct gps_location gl;
+		sirf_init(&p);
+		while (tries--)
+			if (!sirf_receive(&p, &gl, 1000 * (unsigned int)period + 500) && ++rmc >= 2)
+				return 0;
+		return 1;
+	}
+
+	while (tries--) {
+		// one timeout or garbled sentence just costs a try
+		if (gps_receive_valid(buf, sizeof(buf), 1000 * (unsigned int)period + 500))
+			continue;
+
+		if (!strncmp_P(buf + 3, PSTR("RMC"), 3)) rmc++;
+		else if (!strncmp_P(buf + 3, PSTR("GGA"), 3)) gga++;
+
+		// two RMCs proves the baud, a GGA proves the rates were taken
+		if ((rmc >= 2 || !cfg->rmc_period) && (gga >= 1 || !cfg->gga_period))
+			return 0;
+	}
+
+	return 1;
+}
+
+char gps_configure(const struct gps_config * cfg)
+{
+	char buf[32];
+	struct gps_baud b;
+	uint8_t i;
+
+	for (i=0; i<sizeof(gps_bauds)/sizeof(gps_bauds[0]); i++) {
+		memcpy_P(&b, &gps_bauds[i], sizeof(b));
+		if (b.baud == cfg->baud) break;
+	}
+	if (i == sizeof(gps_bauds)/sizeof(gps_bauds[0])) return 1;
+
+	if (cfg->binary) {
+		// binary output rates can only be set once we are talking binary
+		sirf_start(b.baud);
+		send_flush();	// let the last bytes out before the divisor changes
+		gps_set_baud(b.ubrr, 1);
+		sirf_set_rates(cfg->rmc_period);
+	} else {
+		// output rates first, while we know the receiver can hear us
+		gps_set_rates(cfg->rmc_period, cfg->gga_period);
+
+		if (b.baud != GPS_DEFAULT_BAUD) {
+			// $PSRF100,<protocol>,<baud>,<databits>,<stopbits>,<parity>*CKSUM<CR><LF>
+			snprintf_P(buf, sizeof(buf), PSTR("$PSRF100,1,%u,8,1,0*"), b.baud);
+			send_gps(buf);
+			send_flush();	// let the last bytes out before the divisor changes
+			gps_set_baud(b.ubrr, 1);
+		}
+	}
+
+	if (!gps_verify(cfg)) {
+		lcd_printf_P(PSTR("GPS: %d00 baud\n%s every %ds"), b.baud / 100, cfg->binary ? "bin" : "RMC", cfg->rmc_period);
+		return 0;
+	}
+
+	// try to talk the receiver back down in case it switched and we missed it
+	lcd_printf_P(PSTR("GPS: config\nfailed, 4800"));
+	if (cfg->binary) {
+		// <mid 129> <mode> <rate, checksum> for GGA GLL GSA GSV RMC VTG MSS (unused) ZDA, <unused:2> <baud:2>
+		uint8_t nmea[] = {SIRF_MID_SWITCH_NMEA, 2, 1, 1, 0, 1, 1, 1, 5, 1, 1, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0x12, 0xc0};
+		sirf_send(nmea, sizeof(nmea));
+	} else {
+		snprintf_P(buf, sizeof(buf), PSTR("$PSRF100,1,%u,8,1,0*"), GPS_DEFAULT_BAUD);
+		send_gps(buf);
+	}
+	send_flush();
+	gps_init_serial();
+	gps_set_rates(cfg->rmc_period, cfg->gga_period);
+
+	return 2;
+}
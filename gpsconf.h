@@ -0,0 +1,40 @@
+#ifndef GPSCONF_H
+#define GPSCONF_H
+
+#include <inttypes.h>
+
+/* NMEA message numbers for $PSRF103 */
+#define GPS_MSG_GGA 0
+#define GPS_MSG_GLL 1
+#define GPS_MSG_GSA 2
+#define GPS_MSG_GSV 3
+#define GPS_MSG_RMC 4
+#define GPS_MSG_VTG 5
+
+#define GPS_SENTENCE 84	//longest NMEA sentence plus terminator
+
+struct gps_config {
+	uint16_t baud;		//4800, 9600, 19200, 38400 or 57600
+	uint8_t rmc_period;	//seconds between RMC sentences, SiRF can't go below 1
+	uint8_t gga_period;	//seconds between GGA sentences, 0 = off
+	char binary;		//1 = SiRF binary geodetic messages instead of NMEA (see sirf.c)
+};
+
+/* switches the receiver to the configured protocol, baud and output
+ * rates, re-inits USART0 to match and listens to make sure it took
+ * returns 0 on success, otherwise we are back at 4800 baud NMEA
+ */
+char gps_configure(const struct gps_config * cfg);
+
+/* sets the output period of the RMC and GGA sentences and turns
+ * everything else off (0 = off, in seconds)
+ */
+void gps_set_rates(uint8_t rmc, uint8_t gga);
+
+/* reads the next sentence with a valid checksum into buf (without
+ * the checksum), waiting at most ms per character
+ * returns 0 on success, -1 on timeout, 1 on a bad sentence
+ */
+char gps_receive_valid(char * buf, int len, unsigned int ms);
+
+#endif
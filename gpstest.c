@@ -2,121 +2,396 @@
  * Craig Harrison & Zach Norrison
  * 12/13/2009
  */
- 
+
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
 #include "gps.h"
 #include "serialgps.h"
 #include "lcd.h"
 #include "fat32.h"
 #include "sdcard.h"
 #include "camera.h"
+#include "gpsconf.h"
+#include "sirf.h"
+#include "thin.h"
+#include "trklog.h"
+#include "capture.h"
+#include "sched.h"
+#include "prof.h"
+#include "trace.h"
+#include "fixlat.h"
+#include "iostat.h"
+#include "fmt.h"
 
 void init_logtoggle(void);
 #define CHECK_LOGTOGGLE() (PIND&0x80)
+#define CHECK_STATS() (!(PINB&0x01))	// held, the display shows fix latency
 
-int main (int argc, char* argv[])
-{
-	struct gps_location gl1 , gl2;
+// what the display shows
+enum {SHOW_FIXING, SHOW_ACQUIRED, SHOW_LOST, SHOW_TRACK};
+
+// fixes waiting for the card
+#define LOG_QUEUE 2
+struct log_entry {
+	struct gps_location gl;
 	struct gps_displacement gd;
-	struct fatwrite_t fout;
-	char logging_state = 0;
-	char flag_reset = 0;
+	unsigned int img;
+	uint16_t eol;		// gps_rx_eol() of its sentence
+};
+
+// RMC once a second at 38400 baud, SiRF's NMEA rates can't go any faster
+// but the higher baud gets each sentence to us in a fraction of the time
+// set binary to get the same fixes as SiRF binary frames, no text parsing
+static struct gps_config gcfg = {38400, 1, 0, 0};
+// the receiver talks one or the other, settled before the first byte is read
+static union {
+	struct sirf_parser sp;	// binary
+	char in[80];		// NMEA, a sentence up to its '*', 82 with it and CRLF at most
+} rx;
+static uint8_t in_len;		// 0 between sentences
+static uint8_t in_check, in_sum;	// checksum digits still to come after the '*'
+
+// the receiver's latest fix, the waypoint and the fix being worked on
+static struct gps_location fix, gl1, gl2;
+static struct gps_displacement gd;
+static char have_fix, flag_reset;
+static uint16_t fix_eol, gl2_eol;	// when their sentences came in
+static char fix_new, gl2_new;		// not taken by task_fix, not shown yet
+static char show, spin;
+
+// the session, the photo gets its own file so fixes are logged while it saves
+// and its own sector to fill, fout opens and closes its file in one call
+// and borrows the file system's
+static struct fatwrite_t fout, fphoto;
+static uint8_t photo_sect[512];
+static struct thin_state thin;
+static struct capture_state cap;
+static char logging_state, log_starting, log_ending;
+static char photo_busy;
+static uint16_t photo_t;
+static int img_counter;
+
+static struct log_entry log_queue[LOG_QUEUE];
+static uint8_t log_head, log_count;
+
+/* the photo is saved or given up on, capture learns how long it took */
+static void photo_done(void)
+{
+	// ms to seconds * 16
+	capture_saved(&cap, (uint16_t)(sched_now() - photo_t) * 2UL / 125);
+	camera_standby();
+	photo_busy = 0;
+}
+
+/* a fix is in, the one before it is lost if task_fix never took it */
+static void fix_parsed(void)
+{
+	if (fix_new) fixlat_skipped();
+	fix_new = 1;
+	fix_eol = gps_rx_eol();
+	fixlat_add(FIXLAT_PARSE, sched_now() - fix_eol);
+	trace_add(TRACE_FIX, fix.status);
+	sched_post(SCHED_FIX);
+}
+
+/* turns whatever the receiver sent into fixes */
+static void task_gps(void)
+{
+	int c;
+
+	while ((c = gps_rx_byte()) != -1) {
+		// bytes went missing here, whatever was being put together has a hole
+		if (c == GPS_RX_LOST) {
+			sirf_init(&rx.sp);
+			in_len = in_check = 0;
+			continue;
+		}
+
+		if (gcfg.binary) {
+			if (sirf_feed(&rx.sp, c) == SIRF_MID_GEODETIC && !sirf_fill_location(rx.sp.payload, rx.sp.len, &fix))
+				fix_parsed();
+			continue;
+		}
+
+		// NMEA, '$' up to the '*' the way receive_str() reads it, then
+		// the two hex digits of its checksum, the parser trusts its input
+		if (c == '$') {
+			rx.in[0] = c;
+			in_len = 1;
+			in_check = 0;
+		} else if (in_check) {
+			in_sum = (in_sum << 4) | fmt_hex_digit(c);
+			if (--in_check) continue;
+			if (in_sum == (uint8_t)gps_calcchecksum(rx.in)) {
+				// the parser walks commas, a trailing one keeps it in bounds
+				rx.in[in_len++] = ',';
+				rx.in[in_len] = '\0';
+				if (!gps_log_data(rx.in, &fix)) fix_parsed();
+			}
+			in_len = 0;
+		} else if (!in_len) {
+			continue;
+		} else if (c == '*') {
+			rx.in[in_len] = '\0';
+			in_check = 2;
+			in_sum = 0;
+		} else if (in_len < sizeof(rx.in) - 2) {
+			rx.in[in_len++] = c;
+		} else {
+			in_len = 0;	// too long, wait for the next one
+		}
+	}
+}
+
+/* the oldest queued fix to the card */
+static void log_queue_write(void)
+{
+	struct log_entry * e = &log_queue[log_head];
+
+	log_add(&fout, &e->gl, &e->gd, e->img);
+	fixlat_add(FIXLAT_LOGGED, sched_now() - e->eol);
+	log_head = (log_head + 1) % LOG_QUEUE;
+	log_count--;
+}
+
+static void log_queue_add(unsigned int img)
+{
+	struct log_entry * e;
+
+	// full, make room the slow way
+	if (log_count == LOG_QUEUE) log_queue_write();
+
+	e = &log_queue[(log_head + log_count) % LOG_QUEUE];
+	e->gl = gl2;
+	e->gd = gd;
+	e->img = img;
+	e->eol = gl2_eol;
+	log_count++;
+	sched_post(SCHED_FLUSH);
+}
+
+/* displacement, photos and the log toggle for each fix */
+static void task_fix(void)
+{
+	unsigned char res;
+	unsigned int img;
+
+	gl2 = fix;
+	gl2_eol = fix_eol;
+	gl2_new = 1;
+	fix_new = 0;
+	spin++;
+	sched_post(SCHED_SHOW);
+
+	// wait until valid location
+	if (!have_fix) {
+		if (gl2.status != 'A') {
+			show = SHOW_FIXING;
+			return;
+		}
+		gl1 = gl2;
+		have_fix = 1;
+		show = SHOW_ACQUIRED;
+		return;
+	}
+
+	if (flag_reset) {
+		// reset waypoint
+		gl1 = gl2;
+		flag_reset = 0;
+	}
+
+	// end log, once the photo and the queue are on the card
+	if (logging_state && !CHECK_LOGTOGGLE()) {
+		logging_state = 0;
+		log_ending = 1;
+		sched_post(SCHED_FLUSH);
+	}
+
+	// check if we have a fix
+	if (gl2.status != 'A') {
+		show = SHOW_LOST;
+		return;
+	}
 
+	// compute gps data
+	gps_calc_disp(&gl1, &gl2, &gd);
+	show = SHOW_TRACK;
+
+	// start / update logging
+	if (logging_state) {
+		// add to log, unless neither the track shape nor a photo needs this fix
+		res = capture_check(&cap, &gl2);
+		if (!thin_check(&thin, &gl2) && !res) return;
+		img = TRK_NOPHOTO;
+		if (res) {
+			// ask for it, the wake, snapshot and download run in task_camera()
+			photo_t = sched_now();
+			camera_resolution(res);
+			camera_photo_start(gps_gen_name(img_counter), &gl2, &fphoto);
+			photo_busy = 1;
+			img = img_counter++;
+		}
+		log_queue_add(img);
+	} else if (CHECK_LOGTOGGLE() && !log_ending) {
+		// start logging
+		logging_state = 1;
+		log_starting = 1;
+		flag_reset = 1;
+		img_counter = 0;
+		thin_init(&thin);
+		capture_init(&cap);
+		sched_post(SCHED_FLUSH);
+	}
+}
+
+/* moves the photo along as the camera answers, packets go to the card */
+static void task_camera(void)
+{
+	unsigned char p;
+	char r;
+
+	if (!photo_busy) return;
+
+	p = camera_photo_progress();
+	r = camera_photo_step();
+	if (camera_photo_progress() != p) sched_post(SCHED_SHOW);
+	if (r == CAMERA_BUSY) return;
+
+	photo_done();
+	sched_post(SCHED_SHOW | SCHED_FLUSH);
+}
+
+/* everything the session writes besides the photo, a log entry a pass */
+static void task_flush(void)
+{
+	if (log_starting) {
+		iostat_reset();
+		log_start(&fout);
+		log_starting = 0;
+		fixlat_reset();
+		prof_reset();
+		trace_start(&fout);
+	}
+
+	if ((logging_state || log_ending) && trace_due()) trace_save(&fout);
+
+	if (log_count) {
+		log_queue_write();
+		if (log_count) sched_post(SCHED_FLUSH);
+		return;
+	}
+
+	// end log
+	if (log_ending && !photo_busy) {
+		log_ending = 0;
+		lcd_printf_P(PSTR("log: finishing..\n"));
+		fixlat_save(FIXLAT_NAME, &fout);
+		iostat_save(IOSTAT_NAME, &fout);
+		prof_save(PROF_NAME, &fout);
+		trace_save(&fout);
+		log_end(&fout);
+		camera_sleep();
+		sched_post(SCHED_SHOW);
+	}
+}
+
+/* the LCD itself refreshes in the background, this only says what's on it */
+static void task_show(void)
+{
+	static const char loading_map[] PROGMEM = {'-', '\\', '|', '/'};
+	char c = pgm_read_byte(&loading_map[spin & 0x3]);
+
+	if (CHECK_STATS()) {
+		// p50/p90 ms to the display and to the card
+		lcd_printf_P(PSTR("lcd %d/%d sk%d\nsd %d/%dms"),
+			fixlat_pct(FIXLAT_SHOW, 50), fixlat_pct(FIXLAT_SHOW, 90), fixlat_skips(),
+			fixlat_pct(FIXLAT_LOGGED, 50), fixlat_pct(FIXLAT_LOGGED, 90));
+		return;
+	}
+
+	switch (show) {
+	case SHOW_FIXING:
+		lcd_printf_P(PSTR("GPS Fixing %c\n"), c);
+		break;
+
+	case SHOW_ACQUIRED:
+		lcd_printf_P(PSTR("Acquired Fix"));
+		break;
+
+	case SHOW_LOST:
+		lcd_printf_P(PSTR("Lost GPS Fix %c\n"), c);
+		break;
+
+	case SHOW_TRACK:
+		if (photo_busy)
+			lcd_printf_P(PSTR("I: %d\xb2 F: %d\xb2\nSaving: %d%%"),
+				gd.initial_bearing / 100,
+				gd.final_bearing / 100,
+				camera_photo_progress());
+		else
+			lcd_printf_P(PSTR("I: %d\xb2 F: %d\xb2\nMg: %dm Sp: %d"),
+				gd.initial_bearing / 100,
+				gd.final_bearing / 100,
+				(int)(gd.magnitude / 100),
+				(int)((gl2.isog * 2237UL + 50000) / 100000));	//cm/s to mph
+		break;
+	}
+
+	// the display caught up with the newest fix
+	if (gl2_new) {
+		fixlat_add(FIXLAT_SHOW, sched_now() - gl2_eol);
+		gl2_new = 0;
+	}
+}
+
+// in order, each runs once a pass when one of its events was posted
+static const struct sched_task tasks[] PROGMEM = {
+	{SCHED_GPS, task_gps},
+	{SCHED_FIX, task_fix},
+	{SCHED_CAMERA | SCHED_TICK, task_camera},
+	{SCHED_FLUSH | (TRACE ? SCHED_TICK : 0), task_flush},	// the tick drains the trace
+	{SCHED_SHOW, task_show},
+};
+
+int main (int argc, char* argv[])
+{
 	gps_init_serial();
 	lcd_init();
+	sched_init();
+	prof_init();
+	fixlat_reset();
 	camera_init();
 	camera_sleep();
-	lcd_printf("sd card:\nconnecting");
+	lcd_printf_P(PSTR("sd card:\nconnecting"));
 	char rt = mmc_init();
 	if (rt) {
-		lcd_printf("sd card: error\n");
+		lcd_printf_P(PSTR("sd card: error\n"));
 		while (1) ;
 	}
-	
+
 	init_partition(0);
+	fphoto.buf = photo_sect;
 	init_logtoggle();
-	lcd_printf("GPS ...");
-
-	gps_disable_unwanted();
-
-	char in[64];
-	int i, img_counter = 0;
-	char c = 0;
-	char loading_map[] = {'-', '\\', '|', '/'};
-	const char * fpic;
-
-	while (1) {
-
-		// wait until valid location
-		do {
-			receive_str(in);
-			gps_log_data(in , &gl1);
-			lcd_printf("GPS Fixing %c\n", loading_map[(c++)&0x3]);
-		} while (gl1.status != 'A');
-	
-		// got fix
-		lcd_printf("Acquired Fix");
-
-		// compute displacement
-		while (1) {
-			// read in gps data
-			receive_str(in);
-			if (flag_reset) {
-				// reset waypoint
-				gps_log_data(in, &gl1);
-				flag_reset = 0;
-			}
-			i = gps_log_data(in , &gl2);
-			
-			// end log
-			if (logging_state && !CHECK_LOGTOGGLE()) {
-					logging_state = 0;
-					lcd_printf("log: finishing..\n");
-					log_end(&fout);
-			}
-		
-			// check if we have a fix
-			if (gl2.status != 'A') {
-				lcd_printf("Lost GPS Fix %c\n", loading_map[(c++)&0x3]);
-				continue;
-			}
-		
-			// compute and display gps data
-			gps_calc_disp(&gl1, &gl2, &gd);
-			lcd_printf("I: %d\xb2 F: %d\xb2\nMg: %dm Sp: %d",
-				(int)gd.initial_bearing,
-				(int)gd.final_bearing,
-				(int)gd.magnitude,
-				(int)(1.15*gl2.sog + 0.5));
-			
-			// start / update logging
-			if (logging_state) {
-				// add to log
-				fpic = gps_gen_name(img_counter++);
-				camera_init();
-				camera_takephoto(fpic, &fout);
-				camera_sleep();
-				log_add(&fout, &gl2, &gd, fpic);
-			} else if (CHECK_LOGTOGGLE()) {
-				// start logging
-				logging_state = 1;
-				flag_reset = 1;
-				img_counter = 0;
-				log_start(&fout);
-			}
-		}
+	lcd_printf_P(PSTR("GPS ..."));
+
+	sirf_init(&rx.sp);
+	if (gps_configure(&gcfg)) gcfg.binary = 0;
+
+	show = SHOW_FIXING;
+	sched_run(tasks, sizeof(tasks)/sizeof(tasks[0]));
 
-	}
-	
 	return 0;
 }
 
-/* initializes the log-toggle switch */
+/* initializes the log-toggle switch and the stats button */
 void init_logtoggle(void)
 {
 	DDRD &= ~0x80;
+	DDRB &= ~0x01;
+	PORTB |= 0x01;		// pull-up, the button pulls it low
 }
-
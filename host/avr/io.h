@@ -0,0 +1,18 @@
+/* host stand-in for avr/io.h, only the camera USART so far, as plain
+ * variables a simulator can look at
+ */
+#ifndef HOST_IO_H
+#define HOST_IO_H
+
+#include <inttypes.h>
+
+extern volatile uint8_t UCSR1A, UCSR1B, UCSR1C, UBRR1H, UBRR1L, UDR1;
+
+#define RXCIE1 7
+#define UDRE1 5
+#define RXEN1 4
+#define TXEN1 3
+#define U2X1 1
+#define UCSZ10 1
+
+#endif
@@ -0,0 +1,495 @@
+/* Trailview camera simulator
+ * Runs camera.c against a simulated C328 style camera in the same
+ * process, on a simulated clock: every byte takes its time on the line
+ * at whatever baud each side is set to, the receive interrupt is called
+ * as bytes arrive, and the photos go through fat32.c to a FAT32 image
+ * whose sectors take a fixed time each.  Reports what a photo costs.
+ *
+ * usage: camsim [-n photos] [-R res] [-e rate] [-B maxbaud] [-p maxpkg]
+ *               [-w us] [-r us] [-i image] [-v] [photo.jpg ...]
+ *   -n  photos to take (default 5)
+ *   -R  resolution 160, 320 or 640 (default 640)
+ *   -e  chance of a bit error per byte on the line, both ways
+ *   -B  fastest baud the camera agrees to (default 57600)
+ *   -p  largest package size the camera agrees to (default 512)
+ *   -w  SD latency per sector written, microseconds (default 1500)
+ *   -r  SD latency per sector read, microseconds (default 1000)
+ *   -i  card image, made fresh each run (default camsim.img)
+ *   -v  show the LCD
+ *   the photos are served in turn, made up JPEG-like data without them
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+#include "camera.h"
+#include "fat32.h"
+#include "sdcard.h"
+#include "gps.h"
+#include "sdfile.h"
+#include "sched.h"
+#include "iostat.h"
+
+#define CAM_LATENCY 300		// us from a command to the camera's answer
+#define CAM_SNAPTIME 150000	// us to compress a frame for GETPIC
+#define CAM_SYNCS 4		// SYNCs a cold camera needs before it answers
+#define CAM_HANG 60e6		// us without finishing a photo before giving up
+#define CAM_QUEUE 8192
+
+#define IMG_SECTORS 131072	// 64 MB
+#define IMG_PART 2048
+#define IMG_RESERVED 32
+
+extern int host_verbose;
+void USART1_RX_vect(void);
+
+volatile uint8_t UCSR1A, UCSR1B, UCSR1C, UBRR1H, UBRR1L, UDR1;
+
+/* the clock, and where the time went */
+static double sim_us, stall_us, deadline;
+
+/* bytes on their way to the AVR, with the rate they were sent at */
+static struct {
+	double t;
+	long baud;
+	uint8_t b;
+} queue[CAM_QUEUE];
+static unsigned int q_head, q_tail;
+
+static double line_err;
+
+/* the camera */
+static struct {
+	long baud, maxbaud;
+	unsigned int pkglen, maxpkg;
+	unsigned char res;
+	char synced, asleep, sending;
+	int syncs;
+	uint8_t cmd[6];
+	int cmdlen;
+	double free;		// when its transmitter is idle again
+	uint8_t * pic;
+	long picsize;
+	unsigned long packets;	// sent, retries included
+} cam;
+
+static const struct {
+	uint8_t div;
+	long baud;
+} cam_rates[] = {{0x1f, 57600}, {0x2f, 38400}, {0x3f, 28800}, {0x5f, 19200}, {0x7f, 14400}};
+
+static char ** photos;
+static int nphotos, photo_next;
+
+static long avr_baud(void)
+{
+	unsigned int ubrr = ((unsigned int)UBRR1H << 8) | UBRR1L;
+	return 8000000L / (((UCSR1A & (1<<U2X1)) ? 8 : 16) * (ubrr + 1));
+}
+
+/* a receiver more than 3% off the sender sees garbage */
+static uint8_t line(uint8_t b, long from, long to)
+{
+	if (fabs((double)from - to) > 0.03 * from) return rand();
+	if (line_err > 0 && rand() < line_err * RAND_MAX) b ^= 1 << (rand() & 7);
+	return b;
+}
+
+static void sim_advance(double us)
+{
+	double end = sim_us + us;
+
+	while (q_head != q_tail && queue[q_head].t <= end) {
+		sim_us = queue[q_head].t;
+		UDR1 = line(queue[q_head].b, queue[q_head].baud, avr_baud());
+		q_head = (q_head + 1) % CAM_QUEUE;
+		USART1_RX_vect();
+	}
+	sim_us = end;
+}
+
+/* camera.c times packets on the scheduler's clock and posts their arrival */
+void sched_post(uint8_t events) {}
+uint16_t sched_now(void) { return (uint16_t)(sim_us / 1000); }
+
+void host_delay_us(double us)
+{
+	stall_us += us;
+	sim_advance(us);
+
+	// camera.c waits forever in a few places, the tool shouldn't
+	if (sim_us > deadline) {
+		fprintf(stderr, "camsim: no progress for %.0f s, giving up\n", CAM_HANG / 1e6);
+		exit(1);
+	}
+}
+
+void host_io_us(double us)
+{
+	sim_advance(us);
+}
+
+static void cam_send(const uint8_t * buf, int n, double after)
+{
+	double t = sim_us + after;
+	int i;
+
+	if (t < cam.free) t = cam.free;
+	for (i=0; i<n; i++) {
+		t += 10e6 / cam.baud;
+		queue[q_tail].t = t;
+		queue[q_tail].baud = cam.baud;
+		queue[q_tail].b = buf[i];
+		q_tail = (q_tail + 1) % CAM_QUEUE;
+		if (q_tail == q_head) {
+			fprintf(stderr, "camsim: queue overflow\n");
+			exit(1);
+		}
+	}
+	cam.free = t;
+}
+
+static void cam_reply(uint8_t cmd, uint8_t b3, uint8_t b4, uint8_t b5, uint8_t b6, double after)
+{
+	uint8_t buf[6] = {0xaa, cmd, b3, b4, b5, b6};
+	cam_send(buf, 6, after);
+}
+
+static void cam_ack(uint8_t cmd)
+{
+	cam_reply(0x0e, cmd, 0, 0, 0, CAM_LATENCY);
+}
+
+static void cam_nak(void)
+{
+	cam_reply(0x0f, 0, 0, 0x01, 0, CAM_LATENCY);
+}
+
+/* next photo from the list, or JPEG markers around noise sized for the resolution */
+static void cam_snapshot(void)
+{
+	FILE * f;
+	long i;
+
+	free(cam.pic);
+	if (nphotos) {
+		const char * name = photos[photo_next++ % nphotos];
+		if (!(f = fopen(name, "rb"))) {
+			perror(name);
+			exit(2);
+		}
+		fseek(f, 0, SEEK_END);
+		cam.picsize = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		cam.pic = malloc(cam.picsize);
+		if (fread(cam.pic, 1, cam.picsize, f) != (size_t)cam.picsize) {
+			perror(name);
+			exit(2);
+		}
+		fclose(f);
+		return;
+	}
+
+	cam.picsize = (cam.res == CAMERA_RES_160) ? 5000 : (cam.res == CAMERA_RES_320) ? 14000 : 42000;
+	cam.picsize += rand() % (cam.picsize / 4);
+	cam.pic = malloc(cam.picsize);
+	for (i=0; i<cam.picsize; i++) cam.pic[i] = rand() % 0xff;
+	cam.pic[0] = 0xff;
+	cam.pic[1] = 0xd8;
+	cam.pic[cam.picsize - 2] = 0xff;
+	cam.pic[cam.picsize - 1] = 0xd9;
+}
+
+static void cam_packet(unsigned int id)
+{
+	uint8_t buf[6 + 512];
+	unsigned int data = cam.pkglen - 6, n, i, sum = 0;
+	long pos = (long)id * data;
+
+	if (pos >= cam.picsize) return;
+	n = (cam.picsize - pos < data) ? cam.picsize - pos : data;
+
+	buf[0] = id;
+	buf[1] = id >> 8;
+	buf[2] = n;
+	buf[3] = n >> 8;
+	memcpy(buf + 4, cam.pic + pos, n);
+	for (i=0; i<n+4; i++) sum += buf[i];
+	buf[n + 4] = sum;
+	buf[n + 5] = 0;
+
+	cam_send(buf, n + 6, CAM_LATENCY);
+	cam.packets++;
+}
+
+static void cam_cmd(const uint8_t * c)
+{
+	unsigned int i, len;
+
+	// asleep or not synced yet, only SYNC gets through
+	if (c[1] != 0x0d && c[1] != 0x0e && (cam.asleep || !cam.synced)) return;
+
+	switch (c[1]) {
+	case 0x0d: // SYNC
+		if (!cam.synced && ++cam.syncs < CAM_SYNCS) return;
+		cam.asleep = 0;
+		cam_ack(0x0d);
+		cam_reply(0x0d, 0, 0, 0, 0, 0);
+		break;
+	case 0x0e: // ACK
+		if (c[2] == 0x0d) {
+			cam.synced = 1;
+			cam.syncs = 0;
+		} else if (cam.sending) {
+			i = c[4] | (c[5] << 8);
+			if (i == 0xf0f0) cam.sending = 0;
+			else cam_packet(i);
+		}
+		break;
+	case 0x01: // INITIAL
+		cam.res = c[5];
+		cam_ack(0x01);
+		break;
+	case 0x06: // PKGSIZE
+		len = c[3] | (c[4] << 8);
+		if (len < 64 || len > cam.maxpkg) {
+			cam_nak();
+		} else {
+			cam.pkglen = len;
+			cam_ack(0x06);
+		}
+		break;
+	case 0x07: // SETBAUD, the ACK still goes out at the old rate
+		for (i=0; i<sizeof(cam_rates)/sizeof(cam_rates[0]); i++)
+			if (cam_rates[i].div == c[2] && cam_rates[i].baud <= cam.maxbaud) break;
+		if (i == sizeof(cam_rates)/sizeof(cam_rates[0])) {
+			cam_nak();
+		} else {
+			cam_ack(0x07);
+			cam.baud = cam_rates[i].baud;
+		}
+		break;
+	case 0x05: // SNAPSHOT
+		cam_ack(0x05);
+		cam_snapshot();
+		break;
+	case 0x04: // GETPIC
+		cam_ack(0x04);
+		cam_reply(0x0a, 0x01, cam.picsize, cam.picsize >> 8, cam.picsize >> 16, CAM_SNAPTIME);
+		cam.sending = 1;
+		break;
+	case 0x09: // SLEEP
+		cam_ack(0x09);
+		cam.asleep = 1;
+		cam.synced = 0;
+		break;
+	default:
+		cam_nak();
+	}
+}
+
+/* camera.c's transmitter, the byte takes its time and lands in the camera */
+void camsim_txbyte(char c)
+{
+	long baud = avr_baud();
+
+	sim_advance(10e6 / baud);
+
+	c = line(c, baud, cam.baud);
+	if (!cam.cmdlen && (uint8_t)c != 0xaa) return;
+	cam.cmd[cam.cmdlen++] = c;
+	if (cam.cmdlen == 6) {
+		cam.cmdlen = 0;
+		cam_cmd(cam.cmd);
+	}
+}
+
+static void put16(uint8_t * p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t * p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+/* a FAT32 partition with an empty root directory, the way fat32.c reads it */
+static int mkimage(const char * path)
+{
+	uint8_t s[512];
+	uint32_t part = IMG_SECTORS - IMG_PART;
+	uint32_t spf = (part - IMG_RESERVED + 129) / 130;	// 128 clusters per FAT sector, two FATs
+	FILE * f = fopen(path, "wb");
+	int i;
+
+	if (!f || ftruncate(fileno(f), (off_t)IMG_SECTORS * 512)) return 1;
+
+	// MBR, one partition
+	memset(s, 0, sizeof(s));
+	s[446 + 4] = 0x0c;
+	put32(s + 446 + 8, IMG_PART);
+	put32(s + 446 + 12, part);
+	put16(s + 510, 0xaa55);
+	fseek(f, 0, SEEK_SET);
+	fwrite(s, 1, 512, f);
+
+	// volume ID, and its backup
+	memset(s, 0, sizeof(s));
+	memcpy(s, "\xeb\x58\x90" "TRAILSIM", 11);
+	put16(s + 0x0b, 512);
+	s[0x0d] = 1;
+	put16(s + 0x0e, IMG_RESERVED);
+	s[0x10] = 2;
+	s[0x15] = 0xf8;
+	put32(s + 0x1c, IMG_PART);
+	put32(s + 0x20, part);
+	put32(s + 0x24, spf);
+	put32(s + 0x2c, 2);
+	put16(s + 0x30, 1);
+	put16(s + 0x32, 6);
+	s[0x42] = 0x29;
+	memcpy(s + 0x47, "NO NAME    FAT32   ", 19);
+	put16(s + 510, 0xaa55);
+	for (i=0; i<2; i++) {
+		fseek(f, (long)(IMG_PART + i * 6) * 512, SEEK_SET);
+		fwrite(s, 1, 512, f);
+	}
+
+	// FS info, free count unknown
+	memset(s, 0, sizeof(s));
+	put32(s, 0x41615252);
+	put32(s + 484, 0x61417272);
+	put32(s + 488, 0xffffffff);
+	put32(s + 492, 0xffffffff);
+	put16(s + 510, 0xaa55);
+	fseek(f, (long)(IMG_PART + 1) * 512, SEEK_SET);
+	fwrite(s, 1, 512, f);
+
+	// both FATs, the reserved entries and the root directory's one cluster
+	memset(s, 0, sizeof(s));
+	put32(s, 0x0ffffff8);
+	put32(s + 4, 0x0fffffff);
+	put32(s + 8, 0x0fffffff);
+	for (i=0; i<2; i++) {
+		fseek(f, (long)(IMG_PART + IMG_RESERVED + i * spf) * 512, SEEK_SET);
+		fwrite(s, 1, 512, f);
+	}
+
+	return fclose(f) != 0;
+}
+
+#if IOSTAT
+static void put_stdout(const char * s)
+{
+	fputs(s, stdout);
+}
+#endif
+
+int main(int argc, char * argv[])
+{
+	struct fatwrite_t fw;
+	uint8_t photo_sect[512];
+	struct gps_location gl;
+	const char * image = "camsim.img";
+	char fname[16];
+	int opt, n = 5, res = 640, i, failed = 0;
+	double t0, stall0, io0, save_sum = 0, stall_sum = 0, io_sum = 0;
+	unsigned long pk0, pk_sum = 0;
+	long bytes_sum = 0;
+
+	cam.maxbaud = 57600;
+	cam.maxpkg = 512;
+	while ((opt = getopt(argc, argv, "n:R:e:B:p:w:r:i:v")) != -1) {
+		switch (opt) {
+		case 'n': n = atoi(optarg); break;
+		case 'R': res = atoi(optarg); break;
+		case 'e': line_err = atof(optarg); break;
+		case 'B': cam.maxbaud = atol(optarg); break;
+		case 'p': cam.maxpkg = atoi(optarg); break;
+		case 'w': sdfile_write_us = atof(optarg); break;
+		case 'r': sdfile_read_us = atof(optarg); break;
+		case 'i': image = optarg; break;
+		case 'v': host_verbose = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-n photos] [-R res] [-e rate] [-B maxbaud] [-p maxpkg] [-w us] [-r us] [-i image] [-v] [photo.jpg ...]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (cam.maxpkg > 512) cam.maxpkg = 512;
+	photos = argv + optind;
+	nphotos = argc - optind;
+	srand(1);
+	fw.buf = photo_sect;
+
+	if (mkimage(image) || sdfile_open(image)) {
+		perror(image);
+		return 2;
+	}
+	if (mmc_init() || init_partition(0)) {
+		fprintf(stderr, "%s: fat32.c can't read the image\n", image);
+		return 2;
+	}
+
+	// a cold camera at its power on rate
+	cam.baud = 14400;
+	cam.pkglen = 64;
+	UCSR1A = 1<<UDRE1;
+	camera_resolution(res == 160 ? CAMERA_RES_160 : res == 320 ? CAMERA_RES_320 : CAMERA_RES_640);
+
+	// the same fix on every photo, it only has to end up in the EXIF
+	memset(&gl, 0, sizeof(gl));
+	strcpy(gl.time, "120000.000");
+	strcpy(gl.date, "010110");
+	gl.status = 'A';
+	gl.ilat = 401234567;
+	gl.ilon = -1051234567;
+	gl.isog = 500;
+
+	deadline = sim_us + CAM_HANG;
+	t0 = sim_us;
+	if (camera_wake()) {
+		fprintf(stderr, "camsim: camera didn't start\n");
+		return 1;
+	}
+	camera_standby();
+	printf("link:   %.0f ms to sync and tune, %ld baud, %u byte packets\n", (sim_us - t0) / 1000, cam.baud, cam.pkglen);
+
+	printf("photo         bytes  packets    save ms  packets/s   stall ms   sd ms\n");
+	for (i=0; i<n; i++) {
+		sprintf(fname, "%d.jpg", i);
+		deadline = sim_us + CAM_HANG;
+		t0 = sim_us;
+		stall0 = stall_us;
+		io0 = sdfile_busy_us;
+		pk0 = cam.packets;
+
+		if (camera_wake() || camera_takephoto(fname, &gl, &fw)) {
+			printf("%-12s  failed\n", fname);
+			failed++;
+			continue;
+		}
+		camera_standby();
+
+		t0 = sim_us - t0;
+		printf("%-12s %6ld %8lu %10.1f %10.1f %10.1f %7.1f\n", fname, cam.picsize, cam.packets - pk0,
+			t0 / 1000, (cam.packets - pk0) / (t0 / 1e6), (stall_us - stall0) / 1000, (sdfile_busy_us - io0) / 1000);
+		save_sum += t0;
+		stall_sum += stall_us - stall0;
+		io_sum += sdfile_busy_us - io0;
+		pk_sum += cam.packets - pk0;
+		bytes_sum += cam.picsize;
+	}
+
+	if (n > failed) {
+		i = n - failed;
+		printf("mean         %6ld %8lu %10.1f %10.1f %10.1f %7.1f\n", bytes_sum / i, pk_sum / i,
+			save_sum / i / 1000, pk_sum / (save_sum / 1e6), stall_sum / i / 1000, io_sum / i / 1000);
+		printf("line:   %.0f%% of %ld baud used for picture data\n", 100.0 * bytes_sum * 10 / cam.baud / (save_sum / 1e6), cam.baud);
+	}
+	printf("card:   %lu sector reads, %lu writes\n", (unsigned long)sdfile_reads, (unsigned long)sdfile_writes);
+#if IOSTAT
+	printf("\n");
+	iostat_report(put_stdout);
+#endif
+
+	return failed ? 1 : 0;
+}
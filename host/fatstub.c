@@ -0,0 +1,14 @@
+/* no-op filesystem for host tools that don't need a card image */
+
+#include "fat32.h"
+
+void cd(const char * s) {}
+void del(const char * s) {}
+void touch(const char * s) {}
+char mkdir(const char * dirname) { return 0; }
+int dir_highestnumbered(void) { return 0; }
+char write_start(const char * s, struct fatwrite_t * fwrite) { return 1; }
+char write_append(const char * s, struct fatwrite_t * fwrite) { return 1; }
+void write_add(struct fatwrite_t * fwrite, const char * buf, int count) { fwrite->size += count; }
+void write_add_P(struct fatwrite_t * fwrite, const char * buf, int count) { fwrite->size += count; }
+void write_end(struct fatwrite_t * fwrite) {}
@@ -0,0 +1,269 @@
+/* Trailview fixed point math check
+ * Sweeps fixmath.c and geo.c across their whole input range and the
+ * globe, poles, the antimeridian and nearly antipodal pairs included,
+ * against libm doubles, and fails if anything is past its tolerance.
+ *
+ * usage: geotest [-n pairs] [-v]
+ *   -v  print every failure and the worst error of each check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "fixmath.h"
+#include "geo.h"
+
+#define Q30 1073741824.0
+#define BAM (4294967296.0 / (2 * M_PI))
+
+// tolerances, in the units the values are checked in
+#define TOL_TRIG 1.5e-8		//sine, cosine and vector lengths
+#define TOL_ATAN 1.5e-8		//radians
+#define TOL_E7 1.5e-9		//radians, a binary angle unit
+#define TOL_SQRT 2e-9
+#define TOL_DIST_CM 20		//vincenty, up to 100 km
+#define TOL_DIST_REL 2e-8	//vincenty, past that
+#define TOL_BEARING 0.05	//degrees, lines past 100 m
+#define TOL_HAV_REL 0.006	//haversine against the ellipsoid, plus 5 cm
+#define ANTIPODAL 3		//degrees from the antipode vincenty may give up within
+
+static int verbose, failures;
+
+// worst error seen per check, for picking tolerances
+static struct {
+	const char * what;
+	double err, tol;
+} worst[16];
+
+static void fail(const char * what, double got, double want, double tol, const char * where)
+{
+	failures++;
+	if (verbose || failures <= 20)
+		printf("FAIL %s: %.10g, expected %.10g (tolerance %g) at %s\n", what, got, want, tol, where);
+}
+
+static void check(const char * what, double got, double want, double tol, const char * where)
+{
+	double e = fabs(got - want);
+	unsigned i;
+
+	for (i=0; i<sizeof(worst)/sizeof(worst[0]) - 1 && worst[i].what && worst[i].what != what; i++) ;
+	worst[i].what = what;
+	if (e / tol > worst[i].err / (worst[i].tol ? worst[i].tol : 1) || !worst[i].tol) {
+		worst[i].err = e;
+		worst[i].tol = tol;
+	}
+
+	if (!(e <= tol)) fail(what, got, want, tol, where);
+}
+
+static double frand(double lo, double hi)
+{
+	return lo + (hi - lo) * (rand() / (double)RAND_MAX);
+}
+
+/* Vincenty inverse in doubles, returns 1 if it doesn't converge */
+static int vincenty(double lat1, double lon1, double lat2, double lon2, double * d, double * b1, double * b2)
+{
+	const double a = 6378137, f = 1 / 298.257223563, b = a * (1 - f);
+	double L = (lon2 - lon1) * M_PI / 180;
+	double u1 = atan((1 - f) * tan(lat1 * M_PI / 180)), u2 = atan((1 - f) * tan(lat2 * M_PI / 180));
+	double s1 = sin(u1), c1 = cos(u1), s2 = sin(u2), c2 = cos(u2);
+	double lambda = L, prev, sigma, ss, cs, sa, csqa, c2sm, C, usq, A, B, ds;
+	int lim = 0;
+
+	do {
+		ss = hypot(c2 * sin(lambda), c1 * s2 - s1 * c2 * cos(lambda));
+		if (ss == 0) {
+			*d = *b1 = *b2 = 0;
+			return 0;
+		}
+		cs = s1 * s2 + c1 * c2 * cos(lambda);
+		sigma = atan2(ss, cs);
+		sa = c1 * c2 * sin(lambda) / ss;
+		csqa = 1 - sa * sa;
+		c2sm = csqa ? cs - 2 * s1 * s2 / csqa : 0;
+		C = f / 16 * csqa * (4 + f * (4 - 3 * csqa));
+		prev = lambda;
+		lambda = L + (1 - C) * f * sa * (sigma + C * ss * (c2sm + C * cs * (-1 + 2 * c2sm * c2sm)));
+	} while (fabs(lambda - prev) > 1e-12 && ++lim < 64);
+	if (lim >= 64) return 1;
+
+	usq = csqa * (a * a - b * b) / (b * b);
+	A = 1 + usq / 16384 * (4096 + usq * (-768 + usq * (320 - 175 * usq)));
+	B = usq / 1024 * (256 + usq * (-128 + usq * (74 - 47 * usq)));
+	ds = B * ss * (c2sm + B / 4 * (cs * (-1 + 2 * c2sm * c2sm) - B / 6 * c2sm * (-3 + 4 * ss * ss) * (-3 + 4 * c2sm * c2sm)));
+	*d = b * A * (sigma - ds);
+	*b1 = fmod(atan2(c2 * sin(lambda), c1 * s2 - s1 * c2 * cos(lambda)) * 180 / M_PI + 360, 360);
+	*b2 = fmod(atan2(c1 * sin(lambda), -s1 * c2 + c1 * s2 * cos(lambda)) * 180 / M_PI + 360, 360);
+	return 0;
+}
+
+static double angle_diff(double a, double b)
+{
+	double d = fabs(a - b);
+	return d > 180 ? 360 - d : d;
+}
+
+static void check_trig(void)
+{
+	char where[64];
+	fix30_t s, c, r;
+	double a, x, y;
+	bam_t t;
+	uint32_t i;
+
+	// every 2^-16 of a turn plus random angles, the series cutover included
+	for (i=0; i<(1 << 16) + 100000; i++) {
+		t = (i < (1 << 16)) ? i << 16 : (bam_t)rand() * 2654435761u;
+		if (i >= (1 << 16) && i % 4 == 0) t = (bam_t)(rand() % (1 << 22)) - (1 << 21);
+		fix_sincos(t, &s, &c);
+		a = (int32_t)t / BAM;
+		sprintf(where, "sincos 0x%08x", t);
+		check("sin", s / Q30, sin(a), TOL_TRIG, where);
+		check("cos", c / Q30, cos(a), TOL_TRIG, where);
+	}
+
+	// vectors of every length and direction, near the axes too
+	for (i=0; i<200000; i++) {
+		a = frand(-M_PI, M_PI);
+		if (i % 4 == 0) a = frand(-1e-4, 1e-4) + (rand() % 4) * M_PI / 2;
+		r = (fix30_t)(Q30 * pow(2, frand(-28, 0.5)));
+		x = r * cos(a);
+		y = r * sin(a);
+		t = fix_atan2((fix30_t)lrint(y), (fix30_t)lrint(x), &s);
+		sprintf(where, "atan2(%.0f, %.0f)", y, x);
+		// the vector's own rounding to integers limits short ones
+		check("atan2", remainder((int32_t)t / BAM - atan2(lrint(y), lrint(x)), 2 * M_PI), 0,
+			TOL_ATAN + 1.0 / r, where);
+		check("length", s / Q30, hypot(lrint(x), lrint(y)) / Q30, TOL_TRIG, where);
+	}
+
+	for (i=0; i<100000; i++) {
+		x = (i < 1000) ? i : frand(0, 2 * Q30 - 1);
+		sprintf(where, "sqrt(%.0f)", x);
+		check("sqrt", fix_sqrt((fix30_t)x) / Q30, sqrt((fix30_t)x / Q30), TOL_SQRT, where);
+	}
+
+	for (i=0; i<100000; i++) {
+		x = lrint(frand(-1800000000, 1800000000));
+		sprintf(where, "e7 %.0f", x);
+		check("e7 to bam", remainder((int32_t)fix_e7_to_bam((int32_t)x) / BAM - x / 1e7 * M_PI / 180, 2 * M_PI), 0, TOL_E7, where);
+	}
+}
+
+/* great circle degrees from the first point to the antipode of the second */
+static double antipode_deg(double lat1, double lon1, double lat2, double lon2)
+{
+	double p1 = lat1 * M_PI / 180, p2 = -lat2 * M_PI / 180, dl = (lon2 + 180 - lon1) * M_PI / 180;
+	double h = pow(sin((p2 - p1) / 2), 2) + cos(p1) * cos(p2) * pow(sin(dl / 2), 2);
+
+	return 2 * asin(sqrt(h)) * 180 / M_PI;
+}
+
+/* one pair through vincenty and haversine */
+static void check_pair(double lat1, double lon1, double lat2, double lon2)
+{
+	int32_t a1 = lrint(lat1 * 1e7), o1 = lrint(lon1 * 1e7), a2 = lrint(lat2 * 1e7), o2 = lrint(lon2 * 1e7);
+	struct geo_disp g, h;
+	double d, b1, b2, tol;
+	char where[96];
+	int ref;
+
+	sprintf(where, "(%.7f, %.7f) -> (%.7f, %.7f)", a1 / 1e7, o1 / 1e7, a2 / 1e7, o2 / 1e7);
+	ref = vincenty(a1 / 1e7, o1 / 1e7, a2 / 1e7, o2 / 1e7, &d, &b1, &b2);
+	if (geo_vincenty(a1, o1, a2, o2, &g)) {
+		// it may give up close to the antipode, where the reference struggles too
+		check("gave up, from antipode", antipode_deg(a1 / 1e7, o1 / 1e7, a2 / 1e7, o2 / 1e7), 0, ANTIPODAL, where);
+		return;
+	}
+	if (ref) return;
+
+	tol = (d < 100000) ? TOL_DIST_CM / 100.0 : d * TOL_DIST_REL + TOL_DIST_CM / 100.0;
+	check("vincenty distance m", g.dist / 100.0, d, tol, where);
+	if (d > 100) {
+		check("initial bearing", angle_diff(g.bearing1 / 100.0, b1), 0, TOL_BEARING, where);
+		check("final bearing", angle_diff(g.bearing2 / 100.0, b2), 0, TOL_BEARING, where);
+	}
+
+	geo_haversine(a1, o1, a2, o2, &h);
+	if (d > 1) check("haversine distance m", h.dist / 100.0, d, d * TOL_HAV_REL + 0.05, where);
+}
+
+static double wrap_lon(double lon)
+{
+	return (lon > 180) ? lon - 360 : (lon < -180) ? lon + 360 : lon;
+}
+
+static double clamp_lat(double lat)
+{
+	return (lat > 90) ? 90 : (lat < -90) ? -90 : lat;
+}
+
+static void check_geo(int n)
+{
+	double lat, lon, sc;
+	int i;
+
+	// found past the Q2.30 range of 1 - cos(lambda) near the antimeridian
+	check_pair(38.0136, 25.4331, 40.0895, -154.5685);
+
+	for (i=0; i<n; i++) {
+		lat = frand(-90, 90);
+		lon = frand(-180, 180);
+		switch (i % 6) {
+		case 0:	// walking pace to a few km apart, anywhere
+		case 1:
+			sc = (i % 6) ? 0.05 : 1e-4;
+			check_pair(lat, lon, clamp_lat(lat + frand(-sc, sc)), wrap_lon(lon + frand(-sc, sc)));
+			break;
+		case 2:	// anywhere to anywhere
+			check_pair(lat, lon, frand(-90, 90), frand(-180, 180));
+			break;
+		case 3:	// close to a pole
+			lat = (i & 8 ? 1 : -1) * frand(89, 90);
+			check_pair(lat, lon, clamp_lat(lat + frand(-0.5, 0.5)), frand(-180, 180));
+			break;
+		case 4:	// across the antimeridian
+			lon = (i & 8 ? 1 : -1) * frand(179.9, 180);
+			check_pair(lat, lon, clamp_lat(lat + frand(-0.05, 0.05)), wrap_lon(lon + frand(-0.2, 0.2)));
+			break;
+		case 5:	// nearly antipodal, half a world apart in longitude
+			lat = frand(-60, 60);
+			check_pair(lat, lon, clamp_lat(-lat + frand(-3, 3)), wrap_lon(lon + 180 + frand(-3, 3)));
+			break;
+		}
+	}
+}
+
+int main(int argc, char * argv[])
+{
+	int n = 200000, opt;
+
+	while ((opt = getopt(argc, argv, "n:v")) != -1) {
+		switch (opt) {
+		case 'n': n = atoi(optarg); break;
+		case 'v': verbose = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-n pairs] [-v]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	srand(1);
+	check_trig();
+	check_geo(n);
+
+	if (verbose)
+		for (opt=0; opt<sizeof(worst)/sizeof(worst[0]) && worst[opt].what; opt++)
+			printf("%-22s worst %.3g of %.3g allowed\n", worst[opt].what, worst[opt].err, worst[opt].tol);
+
+	if (failures) {
+		printf("geotest: %d failures\n", failures);
+		return 1;
+	}
+	printf("geotest: ok\n");
+	return 0;
+}
@@ -0,0 +1,319 @@
+/* Trailview GPS replay harness
+ * Runs recorded receiver output through the device's parser and
+ * displacement code on a Linux box.  It times both and checks the
+ * fixed point math against a double precision reference.
+ *
+ * usage: replay [-b] [-s] [-n passes] [-e max_cm] [-d max_cdeg] [-p max_e7] [-f fixes] [-t track.bin] file
+ *   -b  input is a SiRF binary stream instead of NMEA text
+ *   -s  displacement between consecutive fixes instead of from the first
+ *   -n  repeat the timed loops for steadier numbers
+ *   -e  fail (exit 1) if any distance is off by more than max_cm
+ *   -d  fail (exit 1) if any bearing is off by more than max_cdeg
+ *       (bearings are only compared past 10 m, GPS noise dominates below)
+ *   -p  fail (exit 1) if any NMEA coordinate is off strtod by more than
+ *       max_e7 (degrees * 1e7)
+ *   -f  fail (exit 1) unless exactly this many valid fixes were parsed
+ *   -t  write the fixes the logger would keep as a track.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "gps.h"
+#include "sirf.h"
+#include "thin.h"
+#include "trklog.h"
+
+#define sq(a) ((a)*(a))
+#define BEARING_MIN_CM 1000
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* the original double precision Vincenty from gps.c, as the reference */
+static void ref_vincenty(double lat1, double lon1, double lat2, double lon2, double * d, double * b1, double * b2)
+{
+	double a = 6378137, b = 6356752.3142, f = 1/298.257223563;
+	double L = (lon2 - lon1) * M_PI / 180;
+	double u1 = atan((1 - f) * tan(lat1 * M_PI / 180));
+	double u2 = atan((1 - f) * tan(lat2 * M_PI / 180));
+	double s1 = sin(u1), c1 = cos(u1), s2 = sin(u2), c2 = cos(u2);
+	double lambda = L, ltemp, sigma, ss, cs, sa, csqa, c2sm, C, usq, A, B, ds;
+	int lim = 0;
+
+	do {
+		lim++;
+		ss = sqrt(sq(c2 * sin(lambda)) + sq(c1 * s2 - s1 * c2 * cos(lambda)));
+		if (ss == 0) {
+			*d = *b1 = *b2 = 0;
+			return;
+		}
+		cs = s1 * s2 + c1 * c2 * cos(lambda);
+		sigma = atan2(ss, cs);
+		sa = c1 * c2 * sin(lambda) / ss;
+		csqa = 1 - sq(sa);
+		c2sm = csqa ? cs - 2 * s1 * s2 / csqa : 0;
+		C = f / 16 * csqa * (4 + f * (4 - 3 * csqa));
+		ltemp = lambda;
+		lambda = L + (1 - C) * f * sa * (sigma + C * ss * (c2sm + C * cs * (-1 + 2 * sq(c2sm))));
+	} while (fabs(lambda - ltemp) > 1e-12 && lim < 64);
+
+	usq = csqa * (sq(a) - sq(b)) / sq(b);
+	A = 1 + usq / 16384 * (4096 + usq * (-768 + usq * (320 - 175 * usq)));
+	B = usq / 1024 * (256 + usq * (-128 + usq * (74 - 47 * usq)));
+	ds = B * ss * (c2sm + B / 4 * (cs * (-1 + 2 * sq(c2sm)) - B / 6 * c2sm * (-3 + 4 * sq(ss)) * (-3 + 4 * sq(c2sm))));
+
+	*d = b * A * (sigma - ds);
+	*b1 = atan2(c2 * sin(lambda), c1 * s2 - s1 * c2 * cos(lambda)) * 180. / M_PI;
+	*b2 = atan2(c1 * sin(lambda), -s1 * c2 + c1 * s2 * cos(lambda)) * 180. / M_PI;
+	if (*b1 < 0) *b1 += 360.;
+	if (*b2 < 0) *b2 += 360.;
+}
+
+/* ddmm.mmmm text to degrees with strtod, to check the integer parser */
+static double ref_dm(const char * s, char nsew)
+{
+	double dm = strtod(s, NULL);
+	double dd = floor(dm / 100);
+	return (dd + (dm - dd * 100) / 60) * ((nsew == 'S' || nsew == 'W') ? -1 : 1);
+}
+
+/* returns field n of a comma separated sentence */
+static const char * field(const char * s, int n)
+{
+	while (n-- && (s = strchr(s, ',')))
+		s++;
+	return s ? s : "";
+}
+
+static double bearing_err(double a, double b)
+{
+	double e = fabs(a - b);
+	return (e > 180) ? 360 - e : e;
+}
+
+static char * load(const char * name, size_t * len)
+{
+	FILE * f = fopen(name, "rb");
+	char * buf;
+
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(*len + 1);
+	if (!buf || fread(buf, 1, *len, f) != *len) {
+		fclose(f);
+		free(buf);
+		return NULL;
+	}
+	buf[*len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+/* cuts the text into sentences the way receive_str() hands them to
+ * gps_log_data(), '$' up to but not including '*', dropping any with a
+ * bad checksum since the parser trusts its input
+ */
+static size_t split_nmea(char * buf, char *** out, size_t * bad)
+{
+	size_t n = 0, cap = 1024;
+	char ** s = malloc(cap * sizeof(char *));
+	char * p = buf, * end, * star;
+
+	*bad = 0;
+	while ((p = strchr(p, '$'))) {
+		end = p + strcspn(p, "\r\n");
+		star = memchr(p, '*', end - p);
+		if (*end) *end++ = '\0';
+
+		if (!star || end - star < 3 || strtol(star + 1, NULL, 16) != (unsigned char)gps_calcchecksum(p)) {
+			(*bad)++;
+		} else {
+			// the parser walks commas, a trailing one keeps short sentences in bounds
+			*star++ = ',';
+			*star = '\0';
+			if (n == cap) s = realloc(s, (cap *= 2) * sizeof(char *));
+			s[n++] = p;
+		}
+		p = end;
+	}
+
+	*out = s;
+	return n;
+}
+
+int main(int argc, char * argv[])
+{
+	int binary = 0, step = 0, passes = 1, opt, pass;
+	double max_cm = -1, max_cdeg = -1, max_e7 = -1;
+	long want_fixes = -1;
+	size_t len, n = 0, bad = 0, nfix = 0, i;
+	char * buf, ** sentences = NULL, * track = NULL;
+	struct gps_location gl, * fixes;
+	struct gps_displacement * disp;
+	double t0, t_parse, t_disp, parse_err = 0;
+
+	while ((opt = getopt(argc, argv, "bsn:e:d:p:f:t:")) != -1) {
+		switch (opt) {
+			case 'b': binary = 1; break;
+			case 's': step = 1; break;
+			case 'n': passes = atoi(optarg); break;
+			case 'e': max_cm = atof(optarg); break;
+			case 'd': max_cdeg = atof(optarg); break;
+			case 'p': max_e7 = atof(optarg); break;
+			case 'f': want_fixes = atol(optarg); break;
+			case 't': track = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-b] [-s] [-n passes] [-e max_cm] [-d max_cdeg] [-p max_e7] [-f fixes] [-t track.bin] file\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind >= argc || passes < 1) {
+		fprintf(stderr, "usage: %s [-b] [-s] [-n passes] [-e max_cm] [-d max_cdeg] [-p max_e7] [-f fixes] [-t track.bin] file\n", argv[0]);
+		return 2;
+	}
+	if (!(buf = load(argv[optind], &len))) {
+		perror(argv[optind]);
+		return 2;
+	}
+
+	if (binary) {
+		// frames are found and checked as part of the timed parse
+		struct sirf_parser p;
+		fixes = malloc((len / 99 + 1) * sizeof(*fixes));
+
+		t0 = now_ns();
+		for (pass=0; pass<passes; pass++) {
+			sirf_init(&p);
+			n = nfix = 0;
+			for (i=0; i<len; i++) {
+				if (!sirf_feed(&p, buf[i])) continue;
+				n++;
+				if (!sirf_fill_location(p.payload, p.len, &gl) && gl.status == 'A')
+					fixes[nfix++] = gl;
+			}
+		}
+		t_parse = now_ns() - t0;
+	} else {
+		n = split_nmea(buf, &sentences, &bad);
+		fixes = malloc((n + 1) * sizeof(*fixes));
+
+		t0 = now_ns();
+		for (pass=0; pass<passes; pass++) {
+			nfix = 0;
+			for (i=0; i<n; i++)
+				if (!gps_log_data(sentences[i], &gl) && gl.status == 'A')
+					fixes[nfix++] = gl;
+		}
+		t_parse = now_ns() - t0;
+
+		// the integer coordinates against strtod, untimed
+		for (i=0, nfix=0; i<n; i++) {
+			if (gps_log_data(sentences[i], &gl) || gl.status != 'A') continue;
+			double e1 = fabs(gl.ilat / 1e7 - ref_dm(field(sentences[i], 3), *field(sentences[i], 4)));
+			double e2 = fabs(gl.ilon / 1e7 - ref_dm(field(sentences[i], 5), *field(sentences[i], 6)));
+			if (e1 > parse_err) parse_err = e1;
+			if (e2 > parse_err) parse_err = e2;
+			nfix++;
+		}
+	}
+
+	if (nfix < 2) {
+		fprintf(stderr, "%s: need at least two valid fixes, found %zu\n", argv[optind], nfix);
+		return 2;
+	}
+
+	// displacement the way the logger does it
+	disp = malloc(nfix * sizeof(*disp));
+	t0 = now_ns();
+	for (pass=0; pass<passes; pass++)
+		for (i=1; i<nfix; i++)
+			gps_calc_disp(&fixes[step ? i - 1 : 0], &fixes[i], &disp[i]);
+	t_disp = now_ns() - t0;
+
+	// how much of the track the logger would keep
+	struct thin_state thin;
+	struct trk_state trk;
+	struct trk_record r;
+	struct gps_displacement gd;
+	uint8_t rec[TRK_MAXREC];
+	size_t kept = 0, bytes = 4;
+	FILE * tf = NULL;
+
+	if (track && !(tf = fopen(track, "wb"))) {
+		perror(track);
+		return 2;
+	}
+	if (tf) fputs(TRK_MAGIC, tf);
+
+	thin_init(&thin);
+	trk_init(&trk);
+	for (i=0; i<nfix; i++) {
+		if (!thin_check(&thin, &fixes[i])) continue;
+
+		gps_calc_disp(&fixes[0], &fixes[i], &gd);
+		r.time = trk_time(fixes[i].date, fixes[i].time);
+		r.lat = fixes[i].ilat;
+		r.lon = fixes[i].ilon;
+		r.sog = fixes[i].isog;
+		r.cog = fixes[i].icog;
+		r.dist = gd.magnitude;
+		r.bearing = gd.initial_bearing;
+		r.photo = kept++;
+		len = trk_encode(&trk, &r, rec);
+		bytes += len;
+		if (tf) fwrite(rec, 1, len, tf);
+	}
+	if (tf) fclose(tf);
+
+	// compare against the reference
+	double d, b1, b2, e, max_e = 0, sum_e = 0, max_b = 0;
+	for (i=1; i<nfix; i++) {
+		struct gps_location * a = &fixes[step ? i - 1 : 0], * b = &fixes[i];
+		ref_vincenty(a->ilat / 1e7, a->ilon / 1e7, b->ilat / 1e7, b->ilon / 1e7, &d, &b1, &b2);
+		e = fabs(disp[i].magnitude - d * 100);
+		sum_e += e;
+		if (e > max_e) max_e = e;
+		if (d * 100 >= BEARING_MIN_CM) {
+			e = bearing_err(disp[i].initial_bearing / 100., b1);
+			if (e > max_b) max_b = e;
+			e = bearing_err(disp[i].final_bearing / 100., b2);
+			if (e > max_b) max_b = e;
+		}
+	}
+
+	printf("input:        %s (%zu %s", argv[optind], n, binary ? "frames)\n" : "sentences");
+	if (!binary) printf(", %zu bad checksums)\n", bad);
+	printf("fixes:        %zu\n", nfix);
+	printf("parse:        %.1f ns/%s, %.0f %s/s\n", t_parse / passes / n, binary ? "frame" : "sentence",
+		n * passes / (t_parse / 1e9), binary ? "frames" : "sentences");
+	printf("displacement: %.1f ns/fix (%s)\n", t_disp / passes / (nfix - 1), step ? "fix to fix" : "from start");
+	printf("per fix:      %.1f ns parse + displacement\n", t_parse / passes / nfix + t_disp / passes / (nfix - 1));
+	if (!binary) printf("parse error:  max %.2e deg\n", parse_err);
+	printf("dist error:   max %.2f cm, mean %.2f cm\n", max_e, sum_e / (nfix - 1));
+	printf("bearing err:  max %.3f deg (past %d m)\n", max_b, BEARING_MIN_CM / 100);
+	printf("thinning:     %zu of %zu fixes logged\n", kept, nfix);
+	printf("track.bin:    %zu bytes, %.1f per point\n", bytes, kept ? (double)(bytes - 4) / kept : 0.);
+
+	if ((max_cm >= 0 && max_e > max_cm) || (max_cdeg >= 0 && max_b * 100 > max_cdeg) ||
+			(max_e7 >= 0 && parse_err * 1e7 > max_e7)) {
+		printf("FAIL: error over limit\n");
+		return 1;
+	}
+	if (want_fixes >= 0 && nfix != (size_t)want_fixes) {
+		printf("FAIL: %zu fixes, expected %ld\n", nfix, want_fixes);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+/* mmc_* on an image file, see sdfile.h */
+
+#include <stdio.h>
+#include "sdcard.h"
+#include "sdfile.h"
+#include "iostat.h"
+
+double sdfile_read_us = 1000, sdfile_write_us = 1500;
+uint32_t sdfile_reads, sdfile_writes;
+double sdfile_busy_us;
+
+static FILE * sdfile;
+
+int sdfile_open(const char * path)
+{
+	sdfile = fopen(path, "r+b");
+	return sdfile == NULL;
+}
+
+uint8_t mmc_init(void)
+{
+	return sdfile == NULL;
+}
+
+int mmc_readsector(uint32_t lba, uint8_t *buffer)
+{
+	sdfile_reads++;
+	IOSTAT_ADD(reads, 1);
+	sdfile_busy_us += sdfile_read_us;
+	host_io_us(sdfile_read_us);
+
+	if (fseek(sdfile, (long)lba * 512, SEEK_SET) || fread(buffer, 1, 512, sdfile) != 512)
+		return 1;
+	return 0;
+}
+
+unsigned int mmc_writesector(uint32_t lba, uint8_t *buffer)
+{
+	sdfile_writes++;
+	iostat_write(lba);
+	sdfile_busy_us += sdfile_write_us;
+	host_io_us(sdfile_write_us);
+
+	if (fseek(sdfile, (long)lba * 512, SEEK_SET) || fwrite(buffer, 1, 512, sdfile) != 512)
+		return 1;
+	return 0;
+}
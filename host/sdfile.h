@@ -0,0 +1,19 @@
+/* SD card backed by an image file for the host tools, with a fixed
+ * latency per sector so simulated time passes like it does on the card
+ */
+#ifndef HOST_SDFILE_H
+#define HOST_SDFILE_H
+
+#include <inttypes.h>
+
+extern double sdfile_read_us, sdfile_write_us;	//latency per sector
+extern uint32_t sdfile_reads, sdfile_writes;
+extern double sdfile_busy_us;			//total latency so far
+
+/* opens the image, mmc_init() then just checks it's open, returns 0 if ok */
+int sdfile_open(const char * path);
+
+/* called with every sector's latency, the tool advances its clock */
+void host_io_us(double us);
+
+#endif
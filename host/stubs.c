@@ -0,0 +1,34 @@
+/* stand-ins for the AVR-only lcd and serial routines the portable sources call */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+int host_verbose = 0;
+
+void lcd_printf(const char *fmt, ...)
+{
+	va_list ap;
+	if (!host_verbose) return;
+	va_start(ap, fmt);
+	fputs("lcd: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+}
+
+void lcd_printf_P(const char *fmt, ...)
+{
+	va_list ap;
+	if (!host_verbose) return;
+	va_start(ap, fmt);
+	fputs("lcd: ", stderr);
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+}
+
+void lcd_go_line(char line) {}
+void lcd_wdata(unsigned char c) {}
+void send_char(char c) {}
+void send_gps(const char * s) {}
+int receive_char_timeout(unsigned int ms) { return -1; }
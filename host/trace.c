@@ -0,0 +1,174 @@
+/* Trailview trace reader
+ * Reads a session's trace.bin (built with -DTRACE=1) and prints how often
+ * each event came in and the latencies between related ones: end of a
+ * sentence to its parsed fix, a sector write start to its end, an LCD flush
+ * to the refresh catching up, and the gaps between camera packets.
+ *
+ * usage: trace [-t] trace.bin
+ *   -t  also print every event as a timeline
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "sched.h"
+
+#define IDS (TRACE_LOST + 1)
+
+static const char * names[IDS] = {
+	"?", "sentence", "fix", "sect_start", "sect_end",
+	"cam_packet", "lcd_flush", "lcd_done", "overrun", "lost"
+};
+
+struct series {
+	const char * name;
+	uint32_t * v;
+	size_t n, cap;
+};
+
+static void add(struct series * s, uint32_t v)
+{
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 256;
+		s->v = realloc(s->v, s->cap * sizeof(*s->v));
+		if (!s->v) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->v[s->n++] = v;
+}
+
+static int cmp(const void * a, const void * b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double us(uint32_t steps)
+{
+	return (double)steps * SCHED_CLOCK_US;
+}
+
+static void report(struct series * s)
+{
+	size_t n = s->n;
+
+	if (!n) {
+		printf("%-20s      0\n", s->name);
+		return;
+	}
+	qsort(s->v, n, sizeof(*s->v), cmp);
+	printf("%-20s %6lu %9.0f %9.0f %9.0f %9.0f %9.0f\n", s->name, (unsigned long)n,
+		us(s->v[0]), us(s->v[n / 2]), us(s->v[n * 9 / 10]), us(s->v[n * 99 / 100]), us(s->v[n - 1]));
+}
+
+int main(int argc, char * argv[])
+{
+	struct series lat[4] = {
+		{"sentence->fix"}, {"sector write"}, {"lcd flush->done"}, {"camera packet gap"}
+	};
+	unsigned long count[IDS] = {0}, overrun = 0, lost = 0;
+	uint32_t last_sentence = 0, sect = 0, flush = 0, packet = 0, t0 = 0, t;
+	char have_sentence = 0, in_sect = 0, in_flush = 0, have_packet = 0;
+	unsigned char rec[TRACE_RECLEN], magic[sizeof(TRACE_MAGIC) - 1];
+	int timeline = 0, opt, first = 1;
+	FILE * f;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "t")) != -1) {
+		switch (opt) {
+		case 't': timeline = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-t] trace.bin\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-t] trace.bin\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[optind], "rb");
+	if (!f) {
+		perror(argv[optind]);
+		return 1;
+	}
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic))) {
+		fprintf(stderr, "%s: not a trace\n", argv[optind]);
+		return 1;
+	}
+
+	while (fread(rec, 1, TRACE_RECLEN, f) == TRACE_RECLEN) {
+		t = rec[2] | (rec[3] << 8) | ((uint32_t)rec[4] << 16) | ((uint32_t)rec[5] << 24);
+		if (first) {
+			t0 = t;
+			first = 0;
+		}
+		if (rec[0] < IDS) count[rec[0]]++;
+		else count[0]++;
+
+		if (timeline)
+			printf("%12.3f ms  %-10s %u\n", us(t - t0) / 1000, names[rec[0] < IDS ? rec[0] : 0], rec[1]);
+
+		switch (rec[0]) {
+		case TRACE_SENTENCE:
+			last_sentence = t;
+			have_sentence = 1;
+			break;
+		case TRACE_FIX:
+			if (have_sentence) add(&lat[0], t - last_sentence);
+			have_sentence = 0;
+			break;
+		case TRACE_SECT_START:
+			sect = t;
+			in_sect = 1;
+			break;
+		case TRACE_SECT_END:
+			if (in_sect) add(&lat[1], t - sect);
+			in_sect = 0;
+			break;
+		case TRACE_LCD_FLUSH:
+			// the refresh catches up with the first of several flushes
+			if (!in_flush) flush = t;
+			in_flush = 1;
+			break;
+		case TRACE_LCD_DONE:
+			if (in_flush) add(&lat[2], t - flush);
+			in_flush = 0;
+			break;
+		case TRACE_CAM_PACKET:
+			if (have_packet) add(&lat[3], t - packet);
+			packet = t;
+			have_packet = 1;
+			break;
+		case TRACE_OVERRUN:
+			overrun += rec[1];
+			break;
+		case TRACE_LOST:
+			// a gap in the record, nothing pairs across it
+			lost += rec[1];
+			have_sentence = in_sect = in_flush = have_packet = 0;
+			break;
+		}
+	}
+	fclose(f);
+
+	if (timeline) printf("\n");
+	printf("events");
+	for (i=1; i<IDS; i++) printf(" %s %lu", names[i], count[i]);
+	if (count[0]) printf(" unknown %lu", count[0]);
+	printf("\n");
+	printf("bytes overrun %lu, events lost %lu\n\n", overrun, lost);
+
+	printf("%-20s %6s %9s %9s %9s %9s %9s (us)\n", "latency", "count", "min", "p50", "p90", "p99", "max");
+	for (i=0; i<sizeof(lat)/sizeof(lat[0]); i++) {
+		report(&lat[i]);
+		free(lat[i].v);
+	}
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/* Trailview track converter
+ * Turns a session's track.bin into KML (placemarks with the photos plus
+ * the path as a line) or GPX on stdout.
+ *
+ * usage: trk2kml [-g] track.bin > log.kml
+ *   -g  write GPX instead of KML
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trklog.h"
+
+#define EPOCH_2000 946684800L
+
+static void iso_time(uint32_t t, char * buf, size_t len)
+{
+	time_t tt = EPOCH_2000 + (time_t)t;
+	strftime(buf, len, "%Y-%m-%dT%H:%M:%SZ", gmtime(&tt));
+}
+
+static void coord(int32_t e7, char * buf)
+{
+	sprintf(buf, "%s%ld.%07ld", e7 < 0 ? "-" : "", labs((long)e7) / 10000000L, labs((long)e7) % 10000000L);
+}
+
+static void kml(const struct trk_record * r, size_t n)
+{
+	char lat[16], lon[16], t[32];
+	size_t i;
+
+	printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<kml xmlns=\"http://earth.google.com/kml/2.0\">\n<Document>\n<name>Trailview Path</name>\n");
+
+	for (i=0; i<n; i++) {
+		coord(r[i].lat, lat);
+		coord(r[i].lon, lon);
+		iso_time(r[i].time, t, sizeof(t));
+		printf("<Placemark>\n<description><![CDATA[Speed: %u.%02um/s<br><br>", r[i].sog / 100, r[i].sog % 100);
+		printf("<u>From Start:</u><br>Displacement: %lum<br>", (unsigned long)(r[i].dist / 100));
+		printf("Initial: %u&deg;<br>", r[i].bearing / 100);
+		if (r[i].photo != TRK_NOPHOTO)
+			printf("<img src=\"%u.jpg\" width=\"200\">", r[i].photo);
+		printf("]]></description>\n<name>%s</name>\n", t);
+		printf("<Point>\n<coordinates>%s,%s</coordinates>\n</Point>\n</Placemark>\n\n", lon, lat);
+	}
+
+	printf("<Placemark>\n<name>Path</name>\n<LineString>\n<coordinates>\n");
+	for (i=0; i<n; i++) {
+		coord(r[i].lat, lat);
+		coord(r[i].lon, lon);
+		printf("%s,%s\n", lon, lat);
+	}
+	printf("</coordinates>\n</LineString>\n</Placemark>\n</Document>\n</kml>\n");
+}
+
+static void gpx(const struct trk_record * r, size_t n)
+{
+	char lat[16], lon[16], t[32];
+	size_t i;
+
+	printf("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<gpx version=\"1.1\" creator=\"Trailview\" xmlns=\"http://www.topografix.com/GPX/1/1\">\n");
+
+	// photos as waypoints, the fixes as the track
+	for (i=0; i<n; i++) {
+		if (r[i].photo == TRK_NOPHOTO) continue;
+		coord(r[i].lat, lat);
+		coord(r[i].lon, lon);
+		iso_time(r[i].time, t, sizeof(t));
+		printf("<wpt lat=\"%s\" lon=\"%s\"><time>%s</time><name>%u.jpg</name><link href=\"%u.jpg\"/></wpt>\n",
+			lat, lon, t, r[i].photo, r[i].photo);
+	}
+
+	printf("<trk><name>Trailview Path</name><trkseg>\n");
+	for (i=0; i<n; i++) {
+		coord(r[i].lat, lat);
+		coord(r[i].lon, lon);
+		iso_time(r[i].time, t, sizeof(t));
+		printf("<trkpt lat=\"%s\" lon=\"%s\"><time>%s</time><course>%u.%02u</course><speed>%u.%02u</speed></trkpt>\n",
+			lat, lon, t, r[i].cog / 100, r[i].cog % 100, r[i].sog / 100, r[i].sog % 100);
+	}
+	printf("</trkseg></trk>\n</gpx>\n");
+}
+
+int main(int argc, char * argv[])
+{
+	int opt, as_gpx = 0, used;
+	long len, pos, skipped = 0;
+	size_t n = 0;
+	uint8_t * buf;
+	struct trk_record * recs;
+	struct trk_state s;
+	FILE * f;
+
+	while ((opt = getopt(argc, argv, "g")) != -1) {
+		if (opt != 'g') {
+			fprintf(stderr, "usage: %s [-g] track.bin\n", argv[0]);
+			return 2;
+		}
+		as_gpx = 1;
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-g] track.bin\n", argv[0]);
+		return 2;
+	}
+
+	if (!(f = fopen(argv[optind], "rb"))) {
+		perror(argv[optind]);
+		return 2;
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	buf = malloc(len + 1);
+	if (!buf || fread(buf, 1, len, f) != (size_t)len) {
+		perror(argv[optind]);
+		return 2;
+	}
+	fclose(f);
+
+	if (len < 4 || memcmp(buf, TRK_MAGIC, 4)) {
+		fprintf(stderr, "%s: not a track file\n", argv[optind]);
+		return 2;
+	}
+
+	// every record takes at least one byte per field
+	recs = malloc((len / 9 + 1) * sizeof(*recs));
+	trk_init(&s);
+	for (pos=4; pos<len; ) {
+		used = trk_decode(&s, buf + pos, len - pos, &recs[n]);
+		if (used > 0) {
+			pos += used;
+			n++;
+		} else if (used == 0) {
+			// cut short, the logger lost power mid write
+			break;
+		} else {
+			// damaged, skip ahead to the next key record
+			trk_init(&s);
+			pos++;
+			skipped++;
+		}
+	}
+
+	if (skipped || pos < len)
+		fprintf(stderr, "%s: %ld damaged and %ld trailing bytes skipped\n", argv[optind], skipped, len - pos);
+
+	if (as_gpx)
+		gpx(recs, n);
+	else
+		kml(recs, n);
+
+	return 0;
+}
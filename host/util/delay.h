@@ -0,0 +1,10 @@
+/* host stand-in for util/delay.h, the tool decides what waiting means */
+#ifndef HOST_DELAY_H
+#define HOST_DELAY_H
+
+void host_delay_us(double us);
+
+#define _delay_us(us) host_delay_us(us)
+#define _delay_ms(ms) host_delay_us((ms) * 1000.0)
+
+#endif
@@ -0,0 +1,393 @@
+/* Trailview file transfer
+ * Pulls files or raw sectors off the card through the avr644 shell's x
+ * command, at a faster baud for the transfer itself.
+ *
+ * usage: xfer [-d tty] [-s baud] [-b baud] [-o dir] command
+ *   ls                       list the current directory
+ *   get name...              copy files into dir
+ *   all                      copy every file in the directory
+ *   sectors lba count file   copy raw sectors
+ *   -d  serial port (/dev/ttyUSB0)
+ *   -s  the shell's baud (9600)
+ *   -b  transfer baud, 19200 38400 57600 500000 or 1000000 (500000)
+ *   -o  where files go (.)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include "xfer.h"
+
+#define TIMEOUT_MS 500		// silence before the host speaks up in a window
+#define RETRIES 8
+
+struct frame {
+	int type;
+	unsigned int block;
+	unsigned int len;
+	uint8_t data[512];
+};
+
+static int fd = -1;
+static int shell_baud = 9600;
+static int fast_baud = 500000;
+static const char * outdir = ".";
+
+static uint16_t crc_update(uint16_t crc, uint8_t c)
+{
+	int i;
+
+	crc ^= (uint16_t)c << 8;
+	for (i=0; i<8; i++)
+		crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+
+	return crc;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static speed_t speed(int baud)
+{
+	switch (baud) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 500000: return B500000;
+	case 1000000: return B1000000;
+	}
+
+	fprintf(stderr, "unsupported baud %d\n", baud);
+	exit(1);
+}
+
+static void set_baud(int baud)
+{
+	struct termios t;
+
+	if (tcgetattr(fd, &t)) {
+		perror("tcgetattr");
+		exit(1);
+	}
+	cfmakeraw(&t);
+	t.c_cflag |= CLOCAL | CREAD;
+	t.c_cflag &= ~CRTSCTS;
+	cfsetispeed(&t, speed(baud));
+	cfsetospeed(&t, speed(baud));
+	tcsetattr(fd, TCSANOW, &t);
+	tcflush(fd, TCIOFLUSH);
+}
+
+/* next byte, -1 after ms of silence */
+static int get(int ms)
+{
+	struct timeval tv;
+	fd_set fds;
+	uint8_t c;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	tv.tv_sec = ms / 1000;
+	tv.tv_usec = (ms % 1000) * 1000;
+	if (select(fd + 1, &fds, 0, 0, &tv) <= 0 || read(fd, &c, 1) != 1)
+		return -1;
+
+	return c;
+}
+
+static void put(const void * p, size_t n)
+{
+	if (write(fd, p, n) != (ssize_t)n) {
+		perror("write");
+		exit(1);
+	}
+}
+
+static void send_frame(int type, unsigned int block, const void * p, unsigned int len)
+{
+	uint8_t f[8 + 16];
+	uint16_t crc = 0;
+	unsigned int i;
+
+	f[0] = XFER_SOH;
+	f[1] = type;
+	f[2] = block;
+	f[3] = block >> 8;
+	f[4] = len;
+	f[5] = len >> 8;
+	memcpy(f + 6, p, len);
+	for (i=1; i<6 + len; i++) crc = crc_update(crc, f[i]);
+	f[6 + len] = crc;
+	f[7 + len] = crc >> 8;
+	put(f, 8 + len);
+}
+
+/* the next frame's type, 0 after ms of silence or XFER_BAD */
+static int recv_frame(struct frame * f, int ms)
+{
+	uint8_t h[5];
+	uint16_t crc = 0;
+	unsigned int i;
+	int c, lo, hi;
+
+	do {
+		if ((c = get(ms)) < 0) return 0;
+	} while (c != XFER_SOH);
+
+	for (i=0; i<5; i++) {
+		if ((c = get(ms)) < 0) return XFER_BAD;
+		h[i] = c;
+		crc = crc_update(crc, c);
+	}
+	f->type = h[0];
+	f->block = h[1] | h[2] << 8;
+	f->len = h[3] | h[4] << 8;
+	if (f->len > sizeof(f->data)) return XFER_BAD;
+
+	for (i=0; i<f->len; i++) {
+		if ((c = get(ms)) < 0) return XFER_BAD;
+		f->data[i] = c;
+		crc = crc_update(crc, c);
+	}
+	if ((lo = get(ms)) < 0 || (hi = get(ms)) < 0) return XFER_BAD;
+
+	return (lo | hi << 8) == crc ? f->type : XFER_BAD;
+}
+
+/* asks for a new rate and follows the device there */
+static int change_baud(int baud)
+{
+	struct frame f;
+	int i;
+
+	for (i=0; i<RETRIES; i++) {
+		send_frame('R', baud / 100, 0, 0);
+		if (recv_frame(&f, TIMEOUT_MS) == 'K') {
+			tcdrain(fd);
+			usleep(20000);
+			set_baud(baud);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void fat_name(const uint8_t * n, char * s)
+{
+	int i, j = 0;
+
+	for (i=0; i<8 && n[i] != ' '; i++) s[j++] = n[i];
+	if (n[8] != ' ') {
+		s[j++] = '.';
+		for (i=8; i<11 && n[i] != ' '; i++) s[j++] = n[i];
+	}
+	s[j] = '\0';
+}
+
+/* the directory as names, returns how many */
+static int list(char names[][13], int max, int print)
+{
+	struct frame f;
+	uint32_t size;
+	int n = 0, t, i;
+
+	for (i=0; i<RETRIES; i++) {
+		send_frame('L', 0, 0, 0);
+		n = 0;
+		while ((t = recv_frame(&f, TIMEOUT_MS)) == 'D') {
+			if (f.len < 16 || (f.data[11] & 0x18)) continue;	// volume labels and directories
+			size = f.data[12] | f.data[13] << 8 | f.data[14] << 16 | (uint32_t)f.data[15] << 24;
+			if (n < max) fat_name(f.data, names[n]);
+			if (print) printf("%-12s %10lu\n", names[n < max ? n : max - 1], (unsigned long)size);
+			n++;
+		}
+		if (t == 'E') return n < max ? n : max;
+	}
+
+	fprintf(stderr, "listing failed\n");
+	return -1;
+}
+
+/* sends a request and receives the H and B frames it brings into out,
+ * returns bytes or -1
+ */
+static long receive(FILE * out, int type, unsigned int block, const void * p, unsigned int len)
+{
+	struct frame f;
+	uint32_t size;
+	unsigned int blocks, next = 0, base = 0, last, retries = 0;
+	int t, quiet;
+
+	// a little over two blocks' time at the transfer rate
+	quiet = 20 + 2 * 10 * 520 * 1000 / fast_baud;
+
+	// the request or its H got lost, asking again gets the H resent
+	send_frame(type, block, p, len);
+	while ((t = recv_frame(&f, TIMEOUT_MS)) != 'H' || f.len < 6) {
+		if (t == 'X') return -1;
+		if (t == 0) {
+			if (++retries > RETRIES) return -1;
+			send_frame(type, block, p, len);
+		}
+	}
+	size = f.data[0] | f.data[1] << 8 | f.data[2] << 16 | (uint32_t)f.data[3] << 24;
+	blocks = f.data[4] | f.data[5] << 8;
+	retries = 0;
+
+	while (next < blocks) {
+		last = base + XFER_WINDOW < blocks ? base + XFER_WINDOW - 1 : blocks - 1;
+		t = recv_frame(&f, quiet);
+
+		if (t == 'X') return -1;
+
+		if (t == 'B' && f.block == next) {
+			fwrite(f.data, 1, f.len, out);
+			next++;
+			retries = 0;
+		}
+
+		// the device listens once the window is out, answer with where to
+		// carry on, past a damaged block that's where the window starts over
+		if ((t == 'B' && f.block == last) || t == 0) {
+			if (t == 0 && ++retries > RETRIES) return -1;
+			send_frame('A', next, 0, 0);
+			base = next;
+		}
+	}
+
+	fflush(out);
+
+	return size;
+}
+
+static long get_file(const char * name)
+{
+	char path[1024];
+	FILE * out;
+	long n;
+
+	if (strlen(name) > 12) {
+		fprintf(stderr, "%s: not an 8.3 name\n", name);
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", outdir, name);
+	if (!(out = fopen(path, "wb"))) {
+		perror(path);
+		return -1;
+	}
+
+	n = receive(out, 'F', 0, name, strlen(name) + 1);
+	fclose(out);
+	if (n < 0) {
+		fprintf(stderr, "%s: failed\n", name);
+		remove(path);
+	}
+
+	return n;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: xfer [-d tty] [-s baud] [-b baud] [-o dir] ls | get name... | all | sectors lba count file\n");
+	exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+	const char * dev = "/dev/ttyUSB0";
+	char names[256][13];
+	long total = 0, n;
+	double t0, dt;
+	int opt, i, count, err = 0;
+	FILE * out;
+	struct frame f;
+
+	while ((opt = getopt(argc, argv, "d:s:b:o:")) != -1) {
+		switch (opt) {
+		case 'd': dev = optarg; break;
+		case 's': shell_baud = atoi(optarg); break;
+		case 'b': fast_baud = atoi(optarg); break;
+		case 'o': outdir = optarg; break;
+		default: usage();
+		}
+	}
+	if (optind >= argc) usage();
+
+	if ((fd = open(dev, O_RDWR | O_NOCTTY)) < 0) {
+		perror(dev);
+		return 1;
+	}
+	set_baud(shell_baud);
+
+	// out of whatever the shell was doing, then into the transfer
+	put("\nx", 2);
+	usleep(300000);
+	tcflush(fd, TCIFLUSH);
+
+	if (fast_baud != shell_baud && change_baud(fast_baud)) {
+		fprintf(stderr, "no answer at %d baud, is the shell at the prompt?\n", shell_baud);
+		return 1;
+	}
+
+	t0 = now();
+
+	if (!strcmp(argv[optind], "ls")) {
+		err = list(names, 256, 1) < 0;
+	} else if (!strcmp(argv[optind], "get")) {
+		for (i=optind+1; i<argc; i++) {
+			if ((n = get_file(argv[i])) < 0) err = 1;
+			else total += n;
+		}
+	} else if (!strcmp(argv[optind], "all")) {
+		count = list(names, 256, 0);
+		if (count < 0) err = 1;
+		for (i=0; i<count; i++) {
+			if ((n = get_file(names[i])) < 0) err = 1;
+			else total += n;
+			printf("%s %ld\n", names[i], n);
+		}
+	} else if (!strcmp(argv[optind], "sectors") && argc - optind == 4) {
+		if (!(out = fopen(argv[optind+3], "wb"))) {
+			perror(argv[optind+3]);
+			err = 1;
+		} else {
+			uint32_t lba = strtoul(argv[optind+1], 0, 0);
+			uint8_t d[4] = {lba, lba >> 8, lba >> 16, lba >> 24};
+			if ((n = receive(out, 'S', strtoul(argv[optind+2], 0, 0), d, 4)) < 0) err = 1;
+			else total += n;
+			fclose(out);
+		}
+	} else {
+		usage();
+	}
+
+	dt = now() - t0;
+	if (total)
+		printf("%ld bytes in %.2f s, %.0f bytes/s at %d baud\n", total, dt, total / dt, fast_baud);
+
+	// back to the shell's rate and prompt
+	if (fast_baud != shell_baud && change_baud(shell_baud))
+		fprintf(stderr, "couldn't go back to %d baud\n", shell_baud);
+	for (i=0; i<RETRIES; i++) {
+		send_frame('Q', 0, 0, 0);
+		if (recv_frame(&f, TIMEOUT_MS) == 'K') break;
+	}
+
+	close(fd);
+
+	return err;
+}
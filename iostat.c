@@ -0,0 +1,107 @@
+//////////////////////////////////
+//SD card I/O counters		//
+//per high level call		//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "iostat.h"
+
+#if IOSTAT
+
+#include "fat32.h"
+#include "fmt.h"
+
+struct iostat_op {
+	uint32_t calls;
+	struct iostat total;
+};
+
+struct iostat iostat;
+static struct iostat_op iostat_ops[IOSTAT_OPS];
+static uint32_t iostat_last = 0xffffffff;	// the sector written last
+
+static const char iostat_n0[] PROGMEM = "log_add";
+static const char iostat_n1[] PROGMEM = "photo";
+static const char iostat_n2[] PROGMEM = "log_start";
+static PGM_P const iostat_names[IOSTAT_OPS] PROGMEM = {
+	iostat_n0, iostat_n1, iostat_n2
+};
+
+#define IOSTAT_FIELDS (sizeof(struct iostat) / sizeof(uint32_t))
+
+void iostat_reset(void)
+{
+	memset(&iostat, 0, sizeof(iostat));
+	memset(iostat_ops, 0, sizeof(iostat_ops));
+}
+
+void iostat_write(uint32_t lba)
+{
+	iostat.writes++;
+	if (lba == iostat_last + 1) iostat.seq++;
+	iostat_last = lba;
+}
+
+void iostat_end(struct iostat_mark * m)
+{
+	uint32_t * now = (uint32_t *)&iostat, * start = (uint32_t *)&m->start;
+	uint32_t * total = (uint32_t *)&iostat_ops[m->op].total;
+	uint8_t i;
+
+	iostat_ops[m->op].calls += m->call;
+	for (i=0; i<IOSTAT_FIELDS; i++) total[i] += now[i] - start[i];
+}
+
+/* the name and calls are already in buf up to p */
+static void iostat_line(void (*put)(const char * s), char * buf, char * p, const struct iostat * st)
+{
+	const uint32_t * v = (const uint32_t *)st;
+	uint8_t i;
+
+	for (i=0; i<IOSTAT_FIELDS; i++) {
+		*p++ = ' ';
+		p = fmt_uint(p, v[i]);
+	}
+	*p++ = '\n';
+	*p = '\0';
+	put(buf);
+}
+
+void iostat_report(void (*put)(const char * s))
+{
+	struct iostat_op * o;
+	char buf[112], * p;
+	uint8_t i;
+
+	fmt_str_P(buf, PSTR("op calls reads writes seq busy fat_reads fat_writes dir_scans\n"));
+	put(buf);
+	iostat_line(put, buf, fmt_str_P(buf, PSTR("all -")), &iostat);
+	for (i=0; i<IOSTAT_OPS; i++) {
+		o = &iostat_ops[i];
+		if (!o->calls) continue;
+		p = fmt_str_P(buf, (PGM_P)pgm_read_ptr(&iostat_names[i]));
+		*p++ = ' ';
+		iostat_line(put, buf, fmt_uint(p, o->calls), &o->total);
+	}
+}
+
+static struct fatwrite_t * iostat_file;
+
+static void iostat_put(const char * s)
+{
+	write_add(iostat_file, s, strlen(s));
+}
+
+void iostat_save(const char * name, struct fatwrite_t * fwrite)
+{
+	del(name);
+	touch(name);
+	if (!write_start(name, fwrite)) return;
+	iostat_file = fwrite;
+	iostat_report(iostat_put);
+	write_end(fwrite);
+}
+
+#endif
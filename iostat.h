@@ -0,0 +1,82 @@
+#ifndef IOSTAT_H
+#define IOSTAT_H
+
+#include <inttypes.h>
+
+struct fatwrite_t;
+
+/* SD card I/O counters, kept by the block layer and fat32.c and charged
+ * to the high level call they happen under
+ * build with -DIOSTAT=1 to turn them on, otherwise every marker compiles
+ * to nothing
+ */
+#ifndef IOSTAT
+#define IOSTAT 0
+#endif
+
+#define IOSTAT_NAME "iostat.txt"
+
+struct iostat {
+	uint32_t reads;		//sectors read from the card
+	uint32_t writes;	//sectors written
+	uint32_t seq;		//writes to the sector after the one before, what a multi-block write would merge
+	uint32_t busy;		//polls waiting on the card, for a data token or a write to finish
+	uint32_t fat_reads;	//FAT sectors read, part of reads
+	uint32_t fat_writes;	//FAT sectors written, both copies, part of writes
+	uint32_t dir_scans;	//directories walked by loop_dir()
+};
+
+/* the calls I/O is charged to, names in iostat.c */
+enum {
+	IOSTAT_LOG_ADD,		//log_add()
+	IOSTAT_PHOTO,		//a photo's camera_photo_step()s, from opening its file
+	IOSTAT_LOG_START,	//log_start()
+	IOSTAT_OPS
+};
+
+#if IOSTAT
+
+extern struct iostat iostat;
+
+struct iostat_mark {
+	uint8_t op;
+	uint8_t call;		//counts as a call, or a part of the last one
+	struct iostat start;
+};
+
+void iostat_reset(void);
+
+/* a sector written, reads and the rest are counted with IOSTAT_ADD */
+void iostat_write(uint32_t lba);
+
+void iostat_end(struct iostat_mark * m);
+
+/* a line at a time through put, everything since iostat_reset() then
+ * calls and totals for each op that ran
+ */
+void iostat_report(void (*put)(const char * s));
+
+/* the report as a file in the current directory */
+void iostat_save(const char * name, struct fatwrite_t * fwrite);
+
+#define IOSTAT_ADD(field, n) (iostat.field += (n))
+
+/* charges the I/O in the rest of the enclosing block to op, IOSTAT_PART
+ * without counting another call, the scopes don't nest
+ */
+#define IOSTAT_SCOPE(op) struct iostat_mark iostat_mark __attribute__((cleanup(iostat_end))) = {(op), 1, iostat}
+#define IOSTAT_PART(op) struct iostat_mark iostat_mark __attribute__((cleanup(iostat_end))) = {(op), 0, iostat}
+
+#else
+
+#define iostat_reset()
+#define iostat_write(lba)
+#define iostat_report(put)
+#define iostat_save(name, fwrite)
+#define IOSTAT_ADD(field, n)
+#define IOSTAT_SCOPE(op)
+#define IOSTAT_PART(op)
+
+#endif
+
+#endif
@@ -4,13 +4,19 @@
 #include <util/delay.h>
 
 #include <stdarg.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
 #include "lcd.h"
+#include "prof.h"
+#include "trace.h"
 
 #define LCD_RS 4
 #define LCD_RW 5
 #define LCD_E 6
 
 #define DATAPORT PORTA
+#define DATAPIN PINA
 #define DATADDR DDRA
 #define CMDPORT PORTD
 #define CMDDDR DDRD
@@ -36,6 +42,92 @@
 
 #define sleep(tms) {_delay_ms(tms);}
 
+// busy flag polls before deciding the display can't be read, about 5 ms
+#define LCD_BUSY_POLLS 1000
+
+#define LCD_ROWS 2
+#define LCD_COLS 16
+#define LCD_CELLS (LCD_ROWS * LCD_COLS)
+#define LCD_ADDR_UNKNOWN 0xff
+
+// refresh tick, timer 0 at 8 MHz / 64 counting to 8 is 64 us, longer than
+// the 37 us a write takes so the timed fallback needs no extra wait
+#define LCD_TICK 7
+#define LCD_REFRESHING() (TIMSK0 & (1 << OCIE0A))
+
+// what the display should show, what it shows, and the cursor into the first
+static char lcd_fb[LCD_ROWS][LCD_COLS];
+static char lcd_glass[LCD_ROWS][LCD_COLS];
+static char lcd_row, lcd_col;
+static volatile unsigned char lcd_addr = LCD_ADDR_UNKNOWN;	// the controller's own cursor
+
+// the refresh interrupt's pass over the cells, and whether the framebuffer
+// changed since that pass began
+static volatile unsigned char lcd_scan = LCD_CELLS;
+static volatile char lcd_dirty;
+
+// boards with RW tied low can't read the busy flag, so each write waits
+// out the datasheet's worst case instead (1.52 ms clear and home, 37 us the rest)
+static char lcd_timed;
+
+/* reads the busy flag once */
+static char lcd_busy(void)
+{
+	char busy;
+
+	// pull-ups on, a display that isn't driving the bus reads busy
+	DATADDR = 0;
+	DATAPORT = 0xff;
+	LCD_CLR(LCD_RS);
+	LCD_SET(LCD_RW);
+	LCD_SET(LCD_E);
+	_delay_us(1);
+	busy = DATAPIN & 0x80;
+	LCD_CLR(LCD_E);
+	LCD_CLR(LCD_RW);
+	DATADDR = 0xff;
+
+	return busy;
+}
+
+/* waits until the controller takes another write */
+static void lcd_ready(void)
+{
+	unsigned int t;
+
+	if (lcd_timed) return;
+
+	for (t = 0; t < LCD_BUSY_POLLS; t++) {
+		if (!lcd_busy()) return;
+		_delay_us(4);
+	}
+
+	lcd_timed = 1;
+}
+
+/* puts one instruction (rs clear) or character (rs set) on the bus */
+static void lcd_strobe(unsigned char c, char rs)
+{
+	if (rs) LCD_SET(LCD_RS) else LCD_CLR(LCD_RS);
+	LCD_CLR(LCD_RW);
+	DATAPORT = c;
+	LCD_SET(LCD_E);
+	_delay_us(1);
+	LCD_CLR(LCD_E);
+}
+
+/* one write from the main loop, while nothing is refreshing */
+static void lcd_write(unsigned char c, char rs)
+{
+	lcd_ready();
+	lcd_strobe(c, rs);
+
+	if (lcd_timed) {
+		if (!rs && c <= 0x03) _delay_ms(2);
+		else _delay_us(50);
+	}
+}
+
 void lcd_init(void)
 {
 	sleep(10);
@@ -47,132 +139,211 @@ void lcd_init(void)
 	LCD_CLR(LCD_RS);
 	LCD_CLR(LCD_RW);
 	LCD_CLR(LCD_E);
+	DDRC = 0xff; // the old write routines drove port C too, keep it that way
 
 	lcd_init_seq();
 }
 
-void wcommand(unsigned char c)
+void lcd_wcommand(unsigned char c)
 {
-	DDRC = 0xff;
-	LCD_CLR(LCD_RS);
-	LCD_CLR(LCD_RW);
-	DATAPORT = 0;
-	sleep(1); //5
-	LCD_SET(LCD_E);
-	asm( "nop" "\n\t" :: );
-	DATAPORT = c;
-	sleep(5); //5
-	LCD_CLR(LCD_E);
-	sleep(5); //5
+	// the bus belongs to the refresh until it's done
+	while (LCD_REFRESHING()) ;
+	lcd_write(c, 0);
+	lcd_addr = LCD_ADDR_UNKNOWN;
+}
+
+/* puts a character in the framebuffer at the cursor, nothing past the edge */
+static void lcd_put(char c)
+{
+	if (lcd_col < LCD_COLS) lcd_fb[(int)lcd_row][(int)lcd_col++] = c;
+}
+
+static int lcd_puts(const char *s)
+{
+	int r = 0;
+	while (*s) {
+		lcd_put(*s++);
+		r++;
+	}
+
+	return r;
+}
+
+static int lcd_put_int(signed int i)
+{
+	char string[7];
+	char tempnum[5];
+	char *pChar = &string[0];
+	char j = 0, r;
+	if (i < 0) {
+		*pChar++ = '-';
+		i = -i;
+	}
+	while (i || !j) {
+		tempnum[(int)j] = i % 10;
+		i /= 10;
+		j++;
+	}
+	r = j;
+	while (j--) *pChar++ = tempnum[(int)j] + '0';
+	*pChar = 0;
+	lcd_puts(&string[0]);
+	
+	return r;
+}
+
+/* hands the framebuffer to the refresh interrupt, which sends the cells
+ * that differ from the glass in the background
+ */
+static void lcd_flush(void)
+{
+	unsigned char sreg = SREG;
+
+	cli();
+	lcd_dirty = 1;
+	TIMSK0 |= (1 << OCIE0A);
+	SREG = sreg;
+	trace_add(TRACE_LCD_FLUSH, 0);
+}
+
+/* one write per tick: the next changed cell, or the cursor move it needs
+ * first when a run of unchanged cells was skipped
+ */
+ISR(TIMER0_COMPA_vect)
+{
+	unsigned char addr;
+	char c;
+
+	if (!lcd_timed && lcd_busy()) return;
+
+	while (lcd_scan < LCD_CELLS && ((char *)lcd_fb)[lcd_scan] == ((char *)lcd_glass)[lcd_scan])
+		lcd_scan++;
+
+	// end of a pass, go again if something changed during it
+	if (lcd_scan == LCD_CELLS) {
+		if (lcd_dirty) {
+			lcd_dirty = 0;
+			lcd_scan = 0;
+		} else {
+			TIMSK0 &= ~(1 << OCIE0A);
+			trace_add(TRACE_LCD_DONE, 0);
+		}
+		return;
+	}
+
+	addr = 0x40 * (lcd_scan / LCD_COLS) + lcd_scan % LCD_COLS;
+	if (lcd_addr != addr) {
+		lcd_strobe(0x80 | addr, 0);
+		lcd_addr = addr;
+		return;
+	}
+
+	c = ((char *)lcd_fb)[lcd_scan];
+	lcd_strobe(c, 1);
+	((char *)lcd_glass)[lcd_scan] = c;
+	lcd_addr = addr + 1;
+	lcd_scan++;
 }
 
 void lcd_wdata(unsigned char c)
 {
-	DDRC = 0xff;
-	LCD_SET(LCD_RS);
-	LCD_CLR(LCD_RW);
-	DATAPORT = c;
-	LCD_SET(LCD_E);
-	sleep(4); //4
-	LCD_CLR(LCD_E);
-	sleep(1); //4
+	lcd_put(c);
+	lcd_flush();
 }
 
 void lcd_go_line(char line)
 {
-	wcommand(0x80 | (0x40 * line));
+	lcd_row = line;
+	lcd_col = 0;
 }
 
 void lcd_go_line_clear(char line)
 {
-	int i;
 	lcd_go_line(line);
-	for (i = 0; i < 16; i++) lcd_wdata(' ');
+	while (lcd_col < LCD_COLS) lcd_put(' ');
+	lcd_flush();
 	lcd_go_line(line);
 }
 
 int lcd_print(const char *s)
 {
-	int r = 0;
-	while (*s) {
-		lcd_wdata(*s++);
-		r++;
-	}
-	
+	int r = lcd_puts(s);
+	lcd_flush();
 	return r;
 }
 
-/* supports %s, %d, %%, and \n */
-void lcd_printf(const char *fmt, ...)
+/* the printf engine, fmt is read from flash if progmem is set
+ * everything goes to the framebuffer first, so only what changed is sent
+ */
+static void lcd_vprintf(const char *fmt, char progmem, va_list ap)
 {
+	char c;
+	PROF_SCOPE(PROF_LCD);
+
 	lcd_go_line(0);
-	char l = 0, i = 0;
 
-	// var args
-	va_list ap;
-	va_start(ap, fmt);
-	
-	while (*fmt) {		
-		switch (*fmt) {
+#define NEXT() (progmem ? pgm_read_byte(fmt) : *fmt)
+	while ((c = NEXT())) {
+		switch (c) {
 		case '%':
-			switch (*++fmt) {
-				case 's': i += lcd_print(va_arg(ap, char*));
+			fmt++;
+			switch ((c = NEXT())) {
+				case 's': lcd_puts(va_arg(ap, char*));
 					break;
 
-				case 'd': i += lcd_print_int(va_arg(ap, int));
+				case 'd': lcd_put_int(va_arg(ap, int));
 					break;
 
-				case 'c': lcd_wdata(va_arg(ap, int));
-					i++;
+				case 'c': lcd_put(va_arg(ap, int));
 					break;
 
 				case '\0': fmt--;
 					break;
 
-				default: lcd_wdata(*fmt);
-					i++;
+				default: lcd_put(c);
 					break;
 			}
 			break;
 
-		case '\n': while (i++ < 16) lcd_wdata(' '); // clear remainder of line
-			lcd_go_line(++l);
-			i = 0;
+		case '\n': while (lcd_col < LCD_COLS) lcd_put(' '); // clear remainder of line
+			if (lcd_row < LCD_ROWS - 1) lcd_go_line(lcd_row + 1);
 			break;
 		
-		default: lcd_wdata(*fmt);
-			i++;
+		default: lcd_put(c);
 			break;
 		}
 		fmt++;
 	}
+#undef NEXT
 	
 	// clear remainder of line
-	while (i++ < 16) lcd_wdata(' ');
+	while (lcd_col < LCD_COLS) lcd_put(' ');
 
+	lcd_flush();
+}
+
+/* supports %s, %d, %%, and \n */
+void lcd_printf(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	lcd_vprintf(fmt, 0, ap);
+	va_end(ap);
+}
+
+/* same with the format string in program memory */
+void lcd_printf_P(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	lcd_vprintf(fmt, 1, ap);
 	va_end(ap);
 }
 
 int lcd_print_int(signed int i)
 {
-	char string[7];
-	char tempnum[5];
-	char *pChar = &string[0];
-	char j = 0, r;
-	if (i < 0) {
-		*pChar++ = '-';
-		i = -i;
-	}
-	while (i || !j) {
-		tempnum[(int)j] = i % 10;
-		i /= 10;
-		j++;
-	}
-	r = j;
-	while (j--) *pChar++ = tempnum[(int)j] + '0';
-	*pChar = 0;
-	lcd_print(&string[0]);
-	
+	int r = lcd_put_int(i);
+	lcd_flush();
 	return r;
 }
 
@@ -180,29 +351,45 @@ void lcd_print_hex(char n)
 {
 	unsigned char t;
 	t = (n>>4)&0xf;
-	lcd_wdata(t + (t < 10 ? '0' : 'a' - 10));
+	lcd_put(t + (t < 10 ? '0' : 'a' - 10));
 	t = n&0xf;
-	lcd_wdata(t + (t < 10 ? '0' : 'a' - 10));
+	lcd_put(t + (t < 10 ? '0' : 'a' - 10));
+	lcd_flush();
 }
 
 void lcd_init_seq(void)
 {
 	sleep(30); // wait at least 15 ms
 	
-	// eight bit interface
-	wcommand(0x30);
+	// eight bit interface, the busy flag can't be read until this is done
+	lcd_timed = 1;
+	lcd_wcommand(0x30);
 	sleep(6);
-	wcommand(0x30);
+	lcd_wcommand(0x30);
 	sleep(6);
-	wcommand(0x30);
+	lcd_wcommand(0x30);
 	sleep(6);
 	
-	wcommand(LCD_INIT_BIGTXT);
+	// the first poll finds out whether this board can read it at all
+	lcd_timed = 0;
+	lcd_wcommand(LCD_INIT_BIGTXT);
 
-	wcommand(LCD_SCREEN_OFF);
+	lcd_wcommand(LCD_SCREEN_OFF);
 	
-	wcommand(LCD_ENTRYMODE); // set entry mode
-	wcommand(LCD_CURSOR_OFF); // cursor type and display on
-	wcommand(LCD_CLEAR); // clear display
+	lcd_wcommand(LCD_ENTRYMODE); // set entry mode
+	lcd_wcommand(LCD_CURSOR_OFF); // cursor type and display on
+	lcd_wcommand(LCD_CLEAR); // clear display
+
+	// a cleared display is all spaces with the cursor home
+	memset(lcd_fb, ' ', sizeof(lcd_fb));
+	memset(lcd_glass, ' ', sizeof(lcd_glass));
+	lcd_row = lcd_col = 0;
+	lcd_addr = 0;
+
+	// refresh timer, CTC, the interrupt only runs while there is something to send
+	TCCR0A = (1 << WGM01);
+	TCCR0B = (1 << CS01) | (1 << CS00);
+	OCR0A = LCD_TICK;
+	sei();
 }
 
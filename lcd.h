@@ -3,9 +3,15 @@
 
 void lcd_init(void);
 
-/* supports %s, %d, %%, and \n */
+/* supports %s, %d, %%, and \n
+ * text goes to a framebuffer that timer 0 sends to the display in the
+ * background, so these return without waiting on it
+ */
 void lcd_printf(const char *fmt, ...);
 
+/* lcd_printf with fmt in program memory, use with PSTR() */
+void lcd_printf_P(const char *fmt, ...);
+
 void lcd_wcommand(unsigned char c);
 
 void lcd_wdata(unsigned char c);
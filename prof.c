@@ -0,0 +1,156 @@
+//////////////////////////////////
+//Hot path profiler		//
+//cycle counts from timer 1	//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "prof.h"
+
+#if PROF
+
+#include "fat32.h"
+#include "fmt.h"
+
+struct prof_stat {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint16_t hist[PROF_BUCKETS];
+};
+
+static struct prof_stat prof_stats[PROF_IDS];
+static volatile uint16_t prof_hi;	// timer 1 overflows
+static uint8_t prof_overhead;		// cycles a marker adds by itself
+
+static const char prof_n0[] PROGMEM = "calc_disp";
+static const char prof_n1[] PROGMEM = "log_data";
+static const char prof_n2[] PROGMEM = "mmc_read";
+static const char prof_n3[] PROGMEM = "mmc_write";
+static const char prof_n4[] PROGMEM = "findempty";
+static const char prof_n5[] PROGMEM = "photo_open";
+static const char prof_n6[] PROGMEM = "photo_step";
+static const char prof_n7[] PROGMEM = "lcd_printf";
+static PGM_P const prof_names[PROF_IDS] PROGMEM = {
+	prof_n0, prof_n1, prof_n2, prof_n3, prof_n4, prof_n5, prof_n6, prof_n7
+};
+
+void prof_init(void)
+{
+	uint32_t t;
+
+	// free running at the CPU clock, the overflow interrupt extends it to 32 bits
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+	TIMSK1 = (1 << TOIE1);
+	sei();
+
+	t = prof_cycles();
+	prof_overhead = prof_cycles() - t;
+	prof_reset();
+}
+
+void prof_reset(void)
+{
+	uint8_t i;
+
+	memset(prof_stats, 0, sizeof(prof_stats));
+	for (i=0; i<PROF_IDS; i++) prof_stats[i].min = 0xffffffff;
+}
+
+uint32_t prof_cycles(void)
+{
+	unsigned char sreg = SREG;
+	uint16_t lo, hi;
+
+	cli();
+	lo = TCNT1;
+	hi = prof_hi;
+	// wrapped but the interrupt hasn't run yet
+	if ((TIFR1 & (1 << TOV1)) && lo < 0x8000) hi++;
+	SREG = sreg;
+
+	return ((uint32_t)hi << 16) | lo;
+}
+
+void prof_end(struct prof_mark * m)
+{
+	uint32_t c = prof_cycles() - m->start, v;
+	struct prof_stat * s = &prof_stats[m->id];
+	uint8_t b = 0;
+
+	c = (c > prof_overhead) ? c - prof_overhead : 0;
+
+	s->count++;
+	s->total += c;
+	if (c < s->min) s->min = c;
+	if (c > s->max) s->max = c;
+
+	for (v = c >> 8; v && b < PROF_BUCKETS - 1; v >>= 2) b++;
+	if (s->hist[b] != 0xffff) s->hist[b]++;
+}
+
+void prof_report(void (*put)(const char * s))
+{
+	struct prof_stat * s;
+	char buf[64], * p;
+	uint8_t i, b;
+
+	// histogram buckets are <256 <1k <4k <16k <64k <256k <1M and the rest
+	fmt_str_P(buf, PSTR("name count min mean max (cycles)\n"));
+	put(buf);
+	for (i=0; i<PROF_IDS; i++) {
+		s = &prof_stats[i];
+		if (!s->count) continue;
+
+		p = fmt_str_P(buf, (PGM_P)pgm_read_ptr(&prof_names[i]));
+		*p++ = ' ';
+		p = fmt_uint(p, s->count);
+		*p++ = ' ';
+		p = fmt_uint(p, s->min);
+		*p++ = ' ';
+		p = fmt_uint(p, s->total / s->count);
+		*p++ = ' ';
+		p = fmt_uint(p, s->max);
+		*p++ = '\n';
+		*p = '\0';
+		put(buf);
+
+		p = buf;
+		for (b=0; b<PROF_BUCKETS; b++) {
+			*p++ = ' ';
+			p = fmt_uint(p, s->hist[b]);
+		}
+		*p++ = '\n';
+		*p = '\0';
+		put(buf);
+	}
+}
+
+static struct fatwrite_t * prof_file;
+
+static void prof_put(const char * s)
+{
+	write_add(prof_file, s, strlen(s));
+}
+
+void prof_save(const char * name, struct fatwrite_t * fwrite)
+{
+	del(name);
+	touch(name);
+	if (!write_start(name, fwrite)) return;
+	prof_file = fwrite;
+	prof_report(prof_put);
+	write_end(fwrite);
+}
+
+ISR(TIMER1_OVF_vect)
+{
+	prof_hi++;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <inttypes.h>
+
+struct fatwrite_t;
+
+/* hot path profiling with timer 1 counting CPU cycles, build with
+ * -DPROF=1 to turn it on, otherwise every marker compiles to nothing
+ */
+#ifndef PROF
+#define PROF 0
+#endif
+
+#define PROF_NAME "prof.txt"
+
+/* the measured spots, names in prof.c */
+enum {
+	PROF_CALC_DISP,		//gps_calc_disp()
+	PROF_LOG_DATA,		//gps_log_data()
+	PROF_MMC_READ,		//mmc_readsector()
+	PROF_MMC_WRITE,		//mmc_writesector()
+	PROF_FINDEMPTY,		//fat_findempty()
+	PROF_PHOTO_OPEN,	//camera_photo_step() opening the photo's file
+	PROF_PHOTO_STEP,	//camera_photo_step(), one packet to the card
+	PROF_LCD,		//lcd_printf() and lcd_printf_P()
+	PROF_IDS
+};
+
+/* histogram buckets by powers of 4 from 256 cycles, the last one is
+ * everything from 1M cycles (0.13 s at 8 MHz) up
+ */
+#define PROF_BUCKETS 8
+
+#if PROF
+
+struct prof_mark {
+	uint8_t id;
+	uint32_t start;
+};
+
+void prof_init(void);
+void prof_reset(void);
+uint32_t prof_cycles(void);	//since prof_init(), wraps after 9 minutes
+void prof_end(struct prof_mark * m);
+
+/* a line at a time through put, per spot: calls, min, mean and max
+ * cycles, then the histogram
+ */
+void prof_report(void (*put)(const char * s));
+
+/* the report as a file in the current directory */
+void prof_save(const char * name, struct fatwrite_t * fwrite);
+
+/* times the rest of the enclosing block, every return included */
+#define PROF_SCOPE(id) struct prof_mark prof_mark __attribute__((cleanup(prof_end))) = {(id), prof_cycles()}
+
+#else
+
+#define prof_init()
+#define prof_reset()
+#define prof_report(put)
+#define prof_save(name, fwrite)
+#define PROF_SCOPE(id)
+
+#endif
+
+#endif
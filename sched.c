@@ -0,0 +1,103 @@
+//////////////////////////////////
+//Cooperative scheduler		//
+//tasks run on events posted	//
+//by interrupts and each other	//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include "sched.h"
+
+// timer 2 at 8 MHz / 64 counting to 125 is 1 ms
+#define SCHED_OCR 124
+
+static volatile uint8_t sched_events;
+static volatile uint32_t sched_ms;
+static uint8_t sched_div;
+
+void sched_init(void)
+{
+	TCCR2A = (1 << WGM21);		// CTC
+	TCCR2B = (1 << CS22);		// / 64
+	OCR2A = SCHED_OCR;
+	TIMSK2 = (1 << OCIE2A);
+	sei();
+}
+
+void sched_post(uint8_t events)
+{
+	unsigned char sreg = SREG;
+
+	cli();
+	sched_events |= events;
+	SREG = sreg;
+}
+
+uint16_t sched_now(void)
+{
+	unsigned char sreg = SREG;
+	uint16_t t;
+
+	cli();
+	t = (uint16_t)sched_ms;
+	SREG = sreg;
+
+	return t;
+}
+
+uint32_t sched_clock(void)
+{
+	unsigned char sreg = SREG;
+	uint32_t ms;
+	uint8_t c;
+
+	cli();
+	ms = sched_ms;
+	c = TCNT2;
+	// wrapped to 0 but the interrupt hasn't counted it yet
+	if ((TIFR2 & (1 << OCF2A)) && c < SCHED_OCR / 2) ms++;
+	SREG = sreg;
+
+	return ms * (SCHED_OCR + 1) + c;
+}
+
+void sched_run(const struct sched_task * tasks, uint8_t n)
+{
+	struct sched_task t;
+	uint8_t events, i;
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
+	while (1) {
+		cli();
+		events = sched_events;
+		sched_events = 0;
+		if (!events) {
+			// sei() takes effect after the next instruction, so an
+			// interrupt that comes in now still wakes the sleep
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+			continue;
+		}
+		sei();
+
+		for (i=0; i<n; i++) {
+			memcpy_P(&t, &tasks[i], sizeof(t));
+			if (t.events & events) t.step();
+		}
+	}
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+	sched_ms++;
+	if (++sched_div >= SCHED_TICK_MS) {
+		sched_div = 0;
+		sched_events |= SCHED_TICK;
+	}
+}
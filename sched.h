@@ -0,0 +1,44 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <inttypes.h>
+
+/* events, posted by interrupts or tasks and taken as the tasks waiting
+ * on them run, one bit each
+ */
+#define SCHED_TICK 0x01		//every SCHED_TICK_MS
+#define SCHED_GPS 0x02		//bytes from the receiver
+#define SCHED_FIX 0x04		//a fix was parsed
+#define SCHED_CAMERA 0x08	//a camera packet came in
+#define SCHED_SHOW 0x10		//the display is out of date
+#define SCHED_FLUSH 0x20	//something waits to go to the card
+
+#define SCHED_TICK_MS 10
+
+/* a step runs when any of its events were posted since the last pass,
+ * it must do a bounded piece of work and return, never wait on a device
+ */
+struct sched_task {
+	uint8_t events;
+	void (*step)(void);
+};
+
+/* starts the millisecond clock and the tick, timer 2 */
+void sched_init(void);
+
+/* marks events, from an interrupt or the main loop */
+void sched_post(uint8_t events);
+
+/* milliseconds since sched_init(), wraps every 65 s */
+uint16_t sched_now(void);
+
+/* the same clock in 8 us steps (SCHED_CLOCK_US), wraps after 9 hours */
+#define SCHED_CLOCK_US 8
+uint32_t sched_clock(void);
+
+/* runs tasks (an array in program memory) forever, the CPU idles
+ * between passes until an interrupt posts something
+ */
+void sched_run(const struct sched_task * tasks, uint8_t n);
+
+#endif
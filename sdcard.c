@@ -2,6 +2,9 @@
 #include "sdcard.h"
 #include "convert.h"
 #include "serial.h"
+#include "prof.h"
+#include "trace.h"
+#include "iostat.h"
 
 /* ------------- SD CARD LOW LEVEL ACCESS ------------- */
 
@@ -81,6 +84,7 @@ uint8_t mmc_datatoken(void)
 	{
 		b = spi_byte(0xff);
 	}
+	IOSTAT_ADD(busy, 0xffff - i);
 	return b;
 }
 
@@ -100,6 +104,9 @@ void mmc_release(void)
 int mmc_readsector(uint32_t lba, uint8_t *buffer)
 {
 	uint16_t i;
+	PROF_SCOPE(PROF_MMC_READ);
+
+	IOSTAT_ADD(reads, 1);
 
 	// send command and sector
 	mmc_send_command(READ_SINGLE_BLOCK, lba<<9);
@@ -126,7 +133,10 @@ unsigned int mmc_writesector(uint32_t lba, uint8_t *buffer)
 {
 	uint16_t i;
 	uint8_t r;
+	PROF_SCOPE(PROF_MMC_WRITE);
 	
+	trace_add(TRACE_SECT_START, lba);
+	iostat_write(lba);
 	CS_ASSERT;
 
 	// send command and sector
@@ -145,14 +155,19 @@ unsigned int mmc_writesector(uint32_t lba, uint8_t *buffer)
 	r = spi_byte(0xff);
     
 	// check for error
-	if ((r & 0x1f) != 0x05) return r;
+	if ((r & 0x1f) != 0x05) {
+		trace_add(TRACE_SECT_END, r);
+		return r;
+	}
     
 	// wait for SD card to complete writing and become idle
 	i = 0xffff;
 	while (!spi_byte(0xff) && --i) ;	// wait for card to finish writing
+	IOSTAT_ADD(busy, 0x10000UL - i);
     
 	mmc_release();	// cleanup
 
+	trace_add(TRACE_SECT_END, i ? 0 : 0xff);
 	if (!i) return -1;	// timeout error
 
 	return 0;
@@ -1,12 +1,32 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "serial.h"
 
+#define F_CPU 8E6
+#include <util/delay.h>
+
+// transmit ring, drained by the UDRE interrupt so sending doesn't wait on the line
+#define TX_RING 64
+#define TX_MASK (TX_RING - 1)
+static volatile unsigned char tx_buf[TX_RING];
+static volatile unsigned char tx_head, tx_tail;
+static volatile char tx_busy;	// a byte went out since the last send_flush()
+
 void init_serial(void)
 {
 	UBRR0H = 0;
-	UBRR0L = 51; // 19.2k BAUD FOR 8MHZ SYSTEM CLOCK
+	UBRR0L = 51; // 9600 BAUD FOR 8MHZ SYSTEM CLOCK
 	UCSR0C = (1<<USBS0)|(3<<UCSZ00);  // 8 BIT NO PARITY 2 STOP
 	UCSR0B = (1<<RXEN0)|(1<<TXEN0); // ENABLE TX AND RX ALSO 8 BIT
+	sei();
+}
+
+void serial_set_baud(unsigned int ubrr, char u2x)
+{
+	UBRR0H = (unsigned char)(ubrr>>8);
+	UBRR0L = (unsigned char)ubrr;
+	if (u2x) UCSR0A |= (1<<U2X0);		//double speed, finer divisors for the fast rates
+	else UCSR0A &= ~(1<<U2X0);
 }
 
 void send_str(const char * s)
@@ -123,10 +143,37 @@ void receive_str(char * buf)
 	*buf = '\0';
 }
 
+/* queues c, only waits when the ring is full */
 void send_char(char c)
 {
-	while ((UCSR0A&(1<<UDRE0)) == 0); // wait until empty
-	UDR0 = c;
+	unsigned char next = (tx_head + 1) & TX_MASK;
+
+	while (next == tx_tail) ;
+	tx_buf[tx_head] = c;
+	tx_head = next;
+	UCSR0B |= (1<<UDRIE0);
+}
+
+/* waits until everything queued has left the shift register */
+void send_flush(void)
+{
+	while (tx_head != tx_tail) ;
+	if (tx_busy) {
+		while ((UCSR0A&(1<<TXC0)) == 0) ;
+		tx_busy = 0;
+	}
+}
+
+ISR(USART0_UDRE_vect)
+{
+	if (tx_head == tx_tail) {
+		UCSR0B &= ~(1<<UDRIE0);
+		return;
+	}
+	UDR0 = tx_buf[tx_tail];
+	tx_tail = (tx_tail + 1) & TX_MASK;
+	tx_busy = 1;
+	UCSR0A = (UCSR0A & (1<<U2X0)) | (1<<TXC0);	// clear transmit complete, send_flush() waits on it
 }
 
 char receive_char(void)
@@ -138,6 +185,17 @@ char receive_char(void)
 	return c;
 }
 
+int receive_char_timeout(unsigned int ms)
+{
+	// short steps, at 1M baud a byte arrives every 10 us
+	unsigned long i = ms * 200UL;
+	while ((UCSR0A&(1<<RXC0)) == 0) {		//wait for char or give up
+		if (!i--) return -1;
+		_delay_us(5);
+	}
+	return (unsigned char)UDR0;
+}
+
 char receive_char_noecho(void)
 {
 	while ((UCSR0A&(1<<RXC0)) == 0);  // wait for char
@@ -6,17 +6,20 @@
 
 // serial functions
 void init_serial(void);
+void serial_set_baud(unsigned int ubrr, char u2x);
 void send_int(unsigned int n);
 void send_hex(unsigned int n);
 void send_hexbyte(unsigned char n);
 void send_str(const char * s);
 void send_nstr(const char * s, int len);
 inline void send_char(char c);
+void send_flush(void);		//waits until everything sent is on the wire
 
 void send_long(uint32_t n);
 uint32_t receive_long(void);
 
 inline char receive_char(void);
+int receive_char_timeout(unsigned int ms);	//-1 on timeout, no echo
 int receive_int(void);
 int receive_hex(void);
 void receive_str(char * buf);
@@ -1,16 +1,59 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "serialgps.h"
 #include "gps.h"
+#include "sched.h"
+#include "trace.h"
+
+#define F_CPU 8E6
+#include <util/delay.h>
 
 #define BAUD 103
 
+// transmit ring, drained by the UDRE interrupt so sending doesn't wait on the line
+#define TX_RING 64
+#define TX_MASK (TX_RING - 1)
+static volatile unsigned char tx_buf[TX_RING];
+static volatile unsigned char tx_head, tx_tail;
+static volatile char tx_busy;	// a byte went out since the last send_flush()
+
+// receive ring, filled by the RX interrupt so a sentence keeps arriving
+// while the main loop is busy with the card or the camera
+#define RX_RING 128
+#define RX_MASK (RX_RING - 1)
+static volatile unsigned char rx_buf[RX_RING];
+static volatile unsigned char rx_head, rx_tail;
+volatile unsigned char gps_rx_overruns;		// bytes lost, ring full or the UART's own
+static volatile unsigned char rx_hole;		// ring position they went missing at,
+static volatile char rx_holed;			// the first one if it happens again before it's read
+
+// when each sentence or frame end still in the ring came in, so the reader
+// gets the time of the one it is at rather than the newest
+#define EOL_QUEUE 4
+#define EOL_MASK (EOL_QUEUE - 1)
+static volatile struct {
+	unsigned char pos;	// ring position of its last byte
+	uint16_t t;
+} rx_eols[EOL_QUEUE];
+static volatile unsigned char eol_head, eol_tail;
+static uint16_t rx_eol;		// of the last one gps_rx_byte() handed out
+
 void gps_init_serial(void)
 {
-	unsigned int baud = BAUD;
-	UBRR0H = (unsigned char)(baud>>8);
-	UBRR0L = (unsigned char)baud; 		//BAUD setting set to BAUD
-	UCSR0B = (1<<RXEN0)|(1<<TXEN0);		// ENABLE TX AND RX ALSO 8 BIT
+	gps_set_baud(BAUD, 0);			//4800 baud, the receiver's default
+	rx_head = rx_tail = 0;
+	eol_head = eol_tail = 0;
+	UCSR0B = (1<<RXCIE0)|(1<<RXEN0)|(1<<TXEN0);	// ENABLE TX AND RX ALSO 8 BIT and INTERRUPT
 	UCSR0C = (3<<UCSZ00);	// 8 BIT NO PARITY 1 STOP
+	sei();
+}
+
+void gps_set_baud(unsigned int ubrr, char u2x)
+{
+	UBRR0H = (unsigned char)(ubrr>>8);
+	UBRR0L = (unsigned char)ubrr;
+	if (u2x) UCSR0A |= (1<<U2X0);		//double speed, finer divisors for the fast rates
+	else UCSR0A &= ~(1<<U2X0);
 }
 
 void send_gps(const char * s)
@@ -140,22 +183,117 @@ void receive_str(char * buf)
 	*buf = '\0';					//NULL terminate that string
 }
 
+/* queues c, only waits when the ring is full */
 void send_char(char c)
 {
-	while ((UCSR0A&(1<<UDRE0)) == 0);		//wait until empty
-	UDR0 = c;					//put c into output location
+	unsigned char next = (tx_head + 1) & TX_MASK;
+
+	while (next == tx_tail) ;
+	tx_buf[tx_head] = c;
+	tx_head = next;
+	UCSR0B |= (1<<UDRIE0);
+}
+
+/* waits until everything queued has left the shift register */
+void send_flush(void)
+{
+	while (tx_head != tx_tail) ;
+	if (tx_busy) {
+		while ((UCSR0A&(1<<TXC0)) == 0) ;
+		tx_busy = 0;
+	}
+}
+
+ISR(USART0_UDRE_vect)
+{
+	if (tx_head == tx_tail) {
+		UCSR0B &= ~(1<<UDRIE0);
+		return;
+	}
+	UDR0 = tx_buf[tx_tail];
+	tx_tail = (tx_tail + 1) & TX_MASK;
+	tx_busy = 1;
+	UCSR0A = (UCSR0A & (1<<U2X0)) | (1<<TXC0);	// clear transmit complete, send_flush() waits on it
+}
+
+ISR(USART0_RX_vect)
+{
+	static unsigned char prev;
+	unsigned char next = (rx_head + 1) & RX_MASK, at = rx_head, c, lost = 0;
+
+	if (UCSR0A & (1<<DOR0)) lost++;
+	c = UDR0;
+	if (next == rx_tail) lost++;
+	if (lost) {
+		// the gap is just before where c goes, or would have
+		if (!rx_holed) {
+			rx_hole = rx_head;
+			rx_holed = 1;
+		}
+		gps_rx_overruns += lost;
+		trace_add(TRACE_OVERRUN, lost);
+	}
+	if (next != rx_tail) {
+		rx_buf[rx_head] = c;
+		rx_head = next;
+	}
+	// end of an NMEA sentence (the '*' it is parsed at) or a SiRF frame,
+	// queued with where it is unless the byte itself was lost
+	if (c == '*' || (prev == 0xb0 && c == 0xb3)) {
+		next = (eol_head + 1) & EOL_MASK;
+		if (rx_head != at && next != eol_tail) {
+			rx_eols[eol_head].pos = at;
+			rx_eols[eol_head].t = sched_now();
+			eol_head = next;
+		}
+		trace_add(TRACE_SENTENCE, c == '*' ? 0 : 1);
+	}
+	prev = c;
+	sched_post(SCHED_GPS);
+}
+
+uint16_t gps_rx_eol(void)
+{
+	return rx_eol;
+}
+
+int gps_rx_byte(void)
+{
+	unsigned char c;
+
+	if (rx_holed && rx_tail == rx_hole) {
+		rx_holed = 0;
+		return GPS_RX_LOST;
+	}
+	if (rx_head == rx_tail) return -1;
+	if (eol_tail != eol_head && rx_eols[eol_tail].pos == rx_tail) {
+		rx_eol = rx_eols[eol_tail].t;
+		eol_tail = (eol_tail + 1) & EOL_MASK;
+	}
+	c = rx_buf[rx_tail];
+	rx_tail = (rx_tail + 1) & RX_MASK;
+	return c;
 }
 
 char receive_char(void)
 {
-	char c;
-	while ((UCSR0A&(1<<RXC0)) == 0);		//wait for char
-	c = UDR0;					//get c from input location
+	int c;
+	while ((c = gps_rx_byte()) < 0) ;		//wait for char
+	return c;
+}
+
+int receive_char_timeout(unsigned int ms)
+{
+	unsigned long i = ms * 10UL;
+	int c;
+	while ((c = gps_rx_byte()) < 0) {		//wait for char or give up
+		if (!i--) return -1;
+		_delay_us(100);
+	}
 	return c;
 }
 
 char receive_char_noecho(void)
 {
-	while ((UCSR0A&(1<<RXC0)) == 0);  // wait for char
-	return UDR0;
+	return receive_char();
 }
@@ -3,11 +3,10 @@
 #define SERIAL_H
 
 #include <inttypes.h>
-#include <avr/io.h>
-#include <avr/iom644.h>
 
 // serial functions
 void gps_init_serial(void);
+void gps_set_baud(unsigned int ubrr, char u2x);
 void send_gps(const char * s);
 void send_int(unsigned int n);
 void send_hex(unsigned int n);
@@ -15,11 +14,17 @@ void send_hexbyte(unsigned char n);
 void send_str(const char * s);
 void send_nstr(const char * s, int len);
 inline void send_char(char c);
+void send_flush(void);		//waits until everything sent is on the wire
 
 void send_long(uint32_t n);
 uint32_t receive_long(void);
 
 inline char receive_char(void);
+int receive_char_timeout(unsigned int ms);	//-1 on timeout
+int gps_rx_byte(void);		//next received byte, -1 if none is waiting
+#define GPS_RX_LOST -2		//or where bytes were lost, once, before the byte after them
+extern volatile unsigned char gps_rx_overruns;
+uint16_t gps_rx_eol(void);	//sched_now() when the sentence or frame whose end gps_rx_byte() last returned came in
 int receive_int(void);
 int receive_hex(void);
 void receive_str(char * buf);
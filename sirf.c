@@ -0,0 +1,154 @@
+//////////////////////////////////
+//SiRF binary protocol driver	//
+//fixed layout messages with	//
+//integer fields, no atof	//
+//////////////////////////////////
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <avr/pgmspace.h>
+#include "gps.h"
+#include "sirf.h"
+#include "serialgps.h"
+
+/* frame layout: A0 A2 <len:2> <payload> <checksum:2> B0 B3, big endian */
+enum {SIRF_START1, SIRF_START2, SIRF_LEN1, SIRF_LEN2, SIRF_PAYLOAD, SIRF_SUM1, SIRF_SUM2, SIRF_END1, SIRF_END2};
+
+#define GET16BE(p) (((uint16_t)(p)[0] << 8) | (p)[1])
+#define GET32BE(p) (((uint32_t)GET16BE(p) << 16) | GET16BE((p) + 2))
+
+void sirf_init(struct sirf_parser * p)
+{
+	p->state = SIRF_START1;
+}
+
+uint8_t sirf_feed(struct sirf_parser * p, uint8_t c)
+{
+	switch (p->state) {
+		case SIRF_START1:
+			if (c == 0xa0) p->state = SIRF_START2;
+			break;
+		case SIRF_START2:
+			p->state = (c == 0xa2) ? SIRF_LEN1 : (c == 0xa0) ? SIRF_START2 : SIRF_START1;
+			break;
+		case SIRF_LEN1:
+			p->len = (uint16_t)(c & 0x7f) << 8;
+			p->state = SIRF_LEN2;
+			break;
+		case SIRF_LEN2:
+			p->len |= c;
+			p->pos = 0;
+			p->sum = 0;
+			p->state = p->len ? SIRF_PAYLOAD : SIRF_START1;
+			break;
+		case SIRF_PAYLOAD:
+			// keep what fits, checksum everything
+			if (p->pos < SIRF_MAXPAYLOAD) p->payload[p->pos] = c;
+			p->sum = (p->sum + c) & 0x7fff;
+			if (++p->pos >= p->len) p->state = SIRF_SUM1;
+			break;
+		case SIRF_SUM1:
+			p->state = (c == (p->sum >> 8)) ? SIRF_SUM2 : SIRF_START1;
+			break;
+		case SIRF_SUM2:
+			p->state = (c == (p->sum & 0xff)) ? SIRF_END1 : SIRF_START1;
+			break;
+		case SIRF_END1:
+			p->state = (c == 0xb0) ? SIRF_END2 : SIRF_START1;
+			break;
+		case SIRF_END2:
+			p->state = SIRF_START1;
+			if (c == 0xb3 && p->len <= SIRF_MAXPAYLOAD) return p->payload[0];
+			break;
+	}
+
+	return 0;
+}
+
+/* writes n as a fixed number of decimal digits */
+static char * put_digits(char * s, uint16_t n, uint8_t digits)
+{
+	s += digits;
+	while (digits--) {
+		*--s = '0' + n % 10;
+		n /= 10;
+	}
+	return s;
+}
+
+char sirf_fill_location(const uint8_t * payload, uint16_t len, struct gps_location * loc)
+{
+	if (payload[0] != SIRF_MID_GEODETIC || len < 91) return -1;
+
+	loc->status = GET16BE(payload + 1) ? 'V' : 'A';		//nav valid is 0 for a fix
+
+	// hhmmss.sss
+	put_digits(loc->time, payload[15], 2);
+	put_digits(loc->time + 2, payload[16], 2);
+	put_digits(loc->time + 4, GET16BE(payload + 17) / 1000, 2);
+	loc->time[6] = '.';
+	put_digits(loc->time + 7, GET16BE(payload + 17) % 1000, 3);
+	loc->time[10] = '\0';
+
+	// ddmmyy
+	put_digits(loc->date, payload[14], 2);
+	put_digits(loc->date + 2, payload[13], 2);
+	put_digits(loc->date + 4, GET16BE(payload + 11) % 100, 2);
+	loc->date[6] = '\0';
+
+	loc->ilat = GET32BE(payload + 23);
+	loc->ilon = GET32BE(payload + 27);
+	loc->isog = GET16BE(payload + 40);
+	loc->icog = GET16BE(payload + 42);
+
+	return 0;
+}
+
+void sirf_send(const uint8_t * payload, uint16_t len)
+{
+	uint16_t i, sum = 0;
+
+	send_char(0xa0);
+	send_char(0xa2);
+	send_char(len >> 8);
+	send_char(len & 0xff);
+	for (i=0; i<len; i++) {
+		send_char(payload[i]);
+		sum = (sum + payload[i]) & 0x7fff;
+	}
+	send_char(sum >> 8);
+	send_char(sum & 0xff);
+	send_char(0xb0);
+	send_char(0xb3);
+}
+
+void sirf_start(uint16_t baud)
+{
+	char buf[32];
+
+	// $PSRF100,<protocol>,<baud>,<databits>,<stopbits>,<parity>*CKSUM<CR><LF>
+	snprintf_P(buf, sizeof(buf), PSTR("$PSRF100,0,%u,8,1,0*"), baud);
+	send_gps(buf);
+}
+
+void sirf_set_rates(uint8_t period)
+{
+	// <mid 166> <mode> <message> <period> <4 reserved>
+	uint8_t off[] = {SIRF_MID_MSGRATE, 2, 0, 0, 0, 0, 0, 0};	//mode 2: every message
+	uint8_t nav[] = {SIRF_MID_MSGRATE, 0, SIRF_MID_GEODETIC, 0, 0, 0, 0, 0};	//mode 0: one message
+
+	nav[3] = period;
+	sirf_send(off, sizeof(off));
+	sirf_send(nav, sizeof(nav));
+}
+
+char sirf_receive(struct sirf_parser * p, struct gps_location * loc, unsigned int ms)
+{
+	int c;
+
+	while ((c = receive_char_timeout(ms)) >= 0)
+		if (sirf_feed(p, c) == SIRF_MID_GEODETIC && !sirf_fill_location(p->payload, p->len, loc))
+			return 0;
+
+	return -1;
+}
@@ -0,0 +1,48 @@
+#ifndef SIRF_H
+#define SIRF_H
+
+#include <inttypes.h>
+
+struct gps_location;
+
+/* SiRF binary message ids */
+#define SIRF_MID_GEODETIC 41	//geodetic navigation data, 91 bytes
+#define SIRF_MID_SWITCH_NMEA 129
+#define SIRF_MID_MSGRATE 166
+
+#define SIRF_MAXPAYLOAD 96	//longer messages are skipped
+
+/* frame parser, fed one byte at a time straight off the UART */
+struct sirf_parser {
+	uint8_t state;
+	uint16_t len;
+	uint16_t pos;
+	uint16_t sum;
+	uint8_t payload[SIRF_MAXPAYLOAD];
+};
+
+void sirf_init(struct sirf_parser * p);
+
+/* returns the message id once a complete frame with a good checksum
+ * has been received (payload in p->payload), otherwise 0
+ */
+uint8_t sirf_feed(struct sirf_parser * p, uint8_t c);
+
+/* fills a gps_location from a geodetic navigation payload, 0 on success */
+char sirf_fill_location(const uint8_t * payload, uint16_t len, struct gps_location * loc);
+
+/* frames and sends a payload to the receiver */
+void sirf_send(const uint8_t * payload, uint16_t len);
+
+/* switches the receiver from NMEA to binary at the given baud */
+void sirf_start(uint16_t baud);
+
+/* outputs only geodetic navigation data, every period seconds */
+void sirf_set_rates(uint8_t period);
+
+/* reads frames until a geodetic navigation message arrives and fills loc
+ * returns 0 on success, -1 if nothing arrived for ms milliseconds
+ */
+char sirf_receive(struct sirf_parser * p, struct gps_location * loc, unsigned int ms);
+
+#endif
@@ -0,0 +1,115 @@
+//////////////////////////////////
+//Track thinning		//
+//drops fixes that add nothing	//
+//to the shape of the track	//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include "gps.h"
+#include "thin.h"
+#include "geo.h"
+
+static uint32_t isqrt(uint32_t v)
+{
+	uint32_t r = 0, bit = (uint32_t)1 << 30;
+
+	while (bit > v) bit >>= 2;
+
+	while (bit) {
+		if (v >= r + bit) {
+			v -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return r;
+}
+
+/* makes gl the new reference point and forgets the window */
+static char thin_keep(struct thin_state * t, const struct gps_location * gl)
+{
+	t->started = 1;
+	t->lat = gl->ilat;
+	t->lon = gl->ilon;
+	t->coslat = geo_coslat(gl->ilat);
+	if (gl->isog >= THIN_MIN_SOG) {
+		t->cog = gl->icog;
+		t->cog_valid = 1;
+	}
+	t->n = 0;
+
+	return 1;
+}
+
+void thin_init(struct thin_state * t)
+{
+	t->started = 0;
+	t->cog_valid = 0;
+	t->n = 0;
+}
+
+char thin_check(struct thin_state * t, const struct gps_location * gl)
+{
+	int32_t x, y, qx, qy;
+	int64_t dot, cross;
+	uint32_t d;
+	uint16_t turn;
+	uint8_t i;
+
+	if (!t->started) return thin_keep(t, gl);
+
+	// offset from the last logged fix
+	geo_offset_cm(t->lat, t->lon, t->coslat, gl->ilat, gl->ilon, &x, &y);
+
+	if (x > THIN_MAX_CM || x < -THIN_MAX_CM || y > THIN_MAX_CM || y < -THIN_MAX_CM)
+		return thin_keep(t, gl);
+
+	// standing still or creeping, wait until we've actually moved
+	d = isqrt((uint32_t)(x * x) + (uint32_t)(y * y));
+	if (d < THIN_MIN_CM) return 0;
+
+	// turned, course only means something while moving
+	if (t->cog_valid && gl->isog >= THIN_MIN_SOG) {
+		turn = (gl->icog > t->cog) ? gl->icog - t->cog : t->cog - gl->icog;
+		if (turn > 18000) turn = 36000 - turn;
+		if (turn > THIN_TURN) return thin_keep(t, gl);
+	}
+
+	// douglas-peucker over the window, the segment from the last logged
+	// fix to this one has to pass within THIN_EPS_CM of every fix between
+	// the fix that breaks it is logged rather than the farthest one since
+	// that is where the photo gets taken
+	for (i=0; i<t->n; i++) {
+		qx = t->x[i];
+		qy = t->y[i];
+		dot = (int64_t)qx * x + (int64_t)qy * y;
+		if (dot < 0) {
+			// behind the last logged fix
+			if ((int64_t)qx * qx + (int64_t)qy * qy > (int64_t)THIN_EPS_CM * THIN_EPS_CM)
+				return thin_keep(t, gl);
+		} else if (dot > (int64_t)d * d) {
+			// past this fix, we doubled back
+			qx -= x;
+			qy -= y;
+			if ((int64_t)qx * qx + (int64_t)qy * qy > (int64_t)THIN_EPS_CM * THIN_EPS_CM)
+				return thin_keep(t, gl);
+		} else {
+			cross = (int64_t)x * qy - (int64_t)y * qx;
+			if (cross < 0) cross = -cross;
+			if (cross > (int64_t)THIN_EPS_CM * d)
+				return thin_keep(t, gl);
+		}
+	}
+
+	// the window bounds the work per fix, and the gap between points
+	if (t->n == THIN_WINDOW) return thin_keep(t, gl);
+
+	t->x[t->n] = x;
+	t->y[t->n] = y;
+	t->n++;
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef THIN_H
+#define THIN_H
+
+#include <inttypes.h>
+
+struct gps_location;
+
+/* tunables, distances in centimeters and angles in degrees * 100 */
+#define THIN_WINDOW 16		//most fixes skipped in a row
+#define THIN_MIN_CM 500		//closer than this to the last point is standing still
+#define THIN_EPS_CM 300		//allowed deviation from the straight line
+#define THIN_MAX_CM 30000	//never go further than this between points
+#define THIN_TURN 3000		//course change that always makes a point
+#define THIN_MIN_SOG 100	//course is noise below this speed (cm/s)
+
+/* online track simplification, every fix since the last logged one is
+ * kept as a flat offset from it in centimeters, which is what
+ * douglas-peucker needs to check the straight line between the two
+ */
+struct thin_state {
+	char started;
+	int32_t lat;		//last logged fix, degrees * 1e7
+	int32_t lon;
+	int32_t coslat;		//cos(lat) in Q2.30, shrinks longitude to centimeters
+	uint16_t cog;		//course at the last logged fix with enough speed
+	char cog_valid;
+	uint8_t n;
+	int16_t x[THIN_WINDOW];
+	int16_t y[THIN_WINDOW];
+};
+
+void thin_init(struct thin_state * t);
+
+/* decides whether a valid fix is worth logging, returns 1 to log it
+ * costs at most THIN_WINDOW cross products per fix
+ */
+char thin_check(struct thin_state * t, const struct gps_location * gl);
+
+#endif
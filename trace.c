@@ -0,0 +1,112 @@
+//////////////////////////////////
+//Field trace			//
+//timestamped events in a RAM	//
+//ring, saved to trace.bin	//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "trace.h"
+
+#if TRACE
+
+#include "fat32.h"
+#include "sched.h"
+
+#define TRACE_MASK (TRACE_RING - 1)
+
+struct trace_event {
+	uint8_t id;
+	uint8_t arg;
+	uint32_t t;
+};
+
+static volatile struct trace_event trace_ring[TRACE_RING];
+static volatile uint8_t trace_head, trace_count, trace_lost;
+static char trace_saving;	// trace_save()'s own sector writes aren't traced
+
+void trace_add(uint8_t id, uint8_t arg)
+{
+	unsigned char sreg = SREG;
+	volatile struct trace_event * e;
+
+	if (trace_saving && (id == TRACE_SECT_START || id == TRACE_SECT_END)) return;
+
+	cli();
+	if (trace_count == TRACE_RING) {
+		if (trace_lost != 0xff) trace_lost++;
+	} else {
+		e = &trace_ring[(trace_head + trace_count) & TRACE_MASK];
+		e->id = id;
+		e->arg = arg;
+		e->t = sched_clock();
+		trace_count++;
+	}
+	SREG = sreg;
+}
+
+void trace_start(struct fatwrite_t * fwrite)
+{
+	cli();
+	trace_head = trace_count = trace_lost = 0;
+	sei();
+
+	del(TRACE_NAME);
+	touch(TRACE_NAME);
+	write_start(TRACE_NAME, fwrite);
+	write_add_P(fwrite, PSTR(TRACE_MAGIC), sizeof(TRACE_MAGIC)-1);
+	write_end(fwrite);
+}
+
+char trace_due(void)
+{
+	return trace_count >= TRACE_RING / 2 || trace_lost;
+}
+
+static void trace_put(struct fatwrite_t * fwrite, uint8_t id, uint8_t arg, uint32_t t)
+{
+	uint8_t rec[TRACE_RECLEN];
+
+	rec[0] = id;
+	rec[1] = arg;
+	rec[2] = t;
+	rec[3] = t >> 8;
+	rec[4] = t >> 16;
+	rec[5] = t >> 24;
+	write_add(fwrite, (const char *)rec, TRACE_RECLEN);
+}
+
+void trace_save(struct fatwrite_t * fwrite)
+{
+	struct trace_event e;
+	uint8_t lost;
+
+	trace_saving = 1;
+	if (!write_append(TRACE_NAME, fwrite)) {
+		trace_saving = 0;
+		return;
+	}
+
+	// interrupts keep adding while this empties the ring
+	while (trace_count) {
+		cli();
+		e = *(struct trace_event *)&trace_ring[trace_head];
+		trace_head = (trace_head + 1) & TRACE_MASK;
+		trace_count--;
+		sei();
+		trace_put(fwrite, e.id, e.arg, e.t);
+	}
+
+	cli();
+	lost = trace_lost;
+	trace_lost = 0;
+	sei();
+	if (lost) trace_put(fwrite, TRACE_LOST, lost, sched_clock());
+
+	write_end(fwrite);
+	trace_saving = 0;
+}
+
+#endif
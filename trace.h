@@ -0,0 +1,56 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+
+struct fatwrite_t;
+
+/* field trace, timestamped events collected in RAM and appended to
+ * trace.bin in the session directory, host/trace makes a timeline and
+ * latency statistics out of it
+ * build with -DTRACE=1 to turn it on, otherwise every call compiles to nothing
+ */
+#ifndef TRACE
+#define TRACE 0
+#endif
+
+#define TRACE_NAME "trace.bin"
+#define TRACE_MAGIC "TRC1"
+#define TRACE_RING 32		//events held in RAM, power of two
+#define TRACE_RECLEN 6		//id, arg, time (4) in sched_clock() steps
+
+/* event ids and what arg holds */
+#define TRACE_SENTENCE 1	//end of a sentence on the line, 0 NMEA or 1 SiRF
+#define TRACE_FIX 2		//fix parsed, status
+#define TRACE_SECT_START 3	//sector write starts, low byte of the lba
+#define TRACE_SECT_END 4	//sector write done, 0 or the error
+#define TRACE_CAM_PACKET 5	//camera packet in, low byte of its number
+#define TRACE_LCD_FLUSH 6	//framebuffer handed to the refresh
+#define TRACE_LCD_DONE 7	//refresh caught up with it
+#define TRACE_OVERRUN 8		//receiver bytes lost, how many
+#define TRACE_LOST 9		//events dropped with the ring full, how many
+
+#if TRACE
+
+/* records an event, safe from interrupts */
+void trace_add(uint8_t id, uint8_t arg);
+
+/* starts trace.bin in the current directory, the ring starts over */
+void trace_start(struct fatwrite_t * fwrite);
+
+/* 1 once the ring is half full and should be saved */
+char trace_due(void);
+
+/* appends the ring to trace.bin */
+void trace_save(struct fatwrite_t * fwrite);
+
+#else
+
+#define trace_add(id, arg)
+#define trace_start(fwrite)
+#define trace_due() 0
+#define trace_save(fwrite)
+
+#endif
+
+#endif
@@ -0,0 +1,158 @@
+//////////////////////////////////
+//Binary track log		//
+//a few bytes per fix instead	//
+//of a KML placemark, convert	//
+//on the PC with host/trk2kml	//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "trklog.h"
+#include "fat32.h"
+#include "fmt.h"
+
+#define TRK_FIELDS 8
+
+/* the record as a list of 32 bit fields, so encoding is one loop */
+static void trk_unpack(const struct trk_record * r, uint32_t * v)
+{
+	v[0] = r->time;
+	v[1] = r->lat;
+	v[2] = r->lon;
+	v[3] = r->sog;
+	v[4] = r->cog;
+	v[5] = r->dist;
+	v[6] = r->bearing;
+	v[7] = r->photo;
+}
+
+static void trk_pack(const uint32_t * v, struct trk_record * r)
+{
+	r->time = v[0];
+	r->lat = v[1];
+	r->lon = v[2];
+	r->sog = v[3];
+	r->cog = v[4];
+	r->dist = v[5];
+	r->bearing = v[6];
+	r->photo = v[7];
+}
+
+/* 7 bits per byte, high bit set on all but the last */
+static uint8_t put_varint(uint8_t * buf, uint32_t v)
+{
+	uint8_t n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = v | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+
+	return n;
+}
+
+/* returns the bytes used, 0 if buf ends first */
+static uint8_t get_varint(const uint8_t * buf, int len, uint32_t * v)
+{
+	uint8_t n = 0, shift = 0;
+
+	*v = 0;
+	while (n < len && n < 5) {
+		*v |= (uint32_t)(buf[n] & 0x7f) << shift;
+		if (!(buf[n++] & 0x80)) return n;
+		shift += 7;
+	}
+
+	return 0;
+}
+
+/* small negative deltas stay small: 0, -1, 1, -2 ... -> 0, 1, 2, 3 ... */
+#define ZIGZAG(d) (((uint32_t)(d) << 1) ^ (uint32_t)((int32_t)(d) >> 31))
+#define UNZIGZAG(z) (((z) >> 1) ^ -((z) & 1))
+
+void trk_init(struct trk_state * s)
+{
+	memset(&s->prev, 0, sizeof(s->prev));
+	s->count = 0;
+}
+
+uint32_t trk_time(const char * date, const char * time)
+{
+	static const uint16_t mdays[] PROGMEM = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+	uint8_t d = fmt_two_digits(date), m = fmt_two_digits(date + 2), y = fmt_two_digits(date + 4);
+	uint16_t days;
+
+	if (m < 1 || m > 12) return 0;
+
+	// 2000 was a leap year, so years before y hold (y + 3) / 4 leap days
+	days = y * 365 + (y + 3) / 4 + pgm_read_word(&mdays[m - 1]) + d - 1;
+	if (m > 2 && !(y & 3)) days++;
+
+	return days * 86400UL + fmt_two_digits(time) * 3600UL + fmt_two_digits(time + 2) * 60 + fmt_two_digits(time + 4);
+}
+
+uint8_t trk_encode(struct trk_state * s, const struct trk_record * r, uint8_t * buf)
+{
+	uint32_t v[TRK_FIELDS], p[TRK_FIELDS];
+	uint8_t i, n = 1, key = (s->count == 0);
+
+	trk_unpack(r, v);
+	trk_unpack(&s->prev, p);
+
+	buf[0] = key ? TRK_KEY : TRK_DELTA;
+	for (i=0; i<TRK_FIELDS; i++)
+		n += put_varint(buf + n, key ? v[i] : ZIGZAG(v[i] - p[i]));
+
+	s->prev = *r;
+	if (++s->count >= TRK_KEYEVERY) s->count = 0;
+
+	return n;
+}
+
+int trk_decode(struct trk_state * s, const uint8_t * buf, int len, struct trk_record * r)
+{
+	uint32_t v[TRK_FIELDS], p[TRK_FIELDS], z;
+	uint8_t i, used;
+	int n = 1;
+
+	if (len < 1) return 0;
+	if (buf[0] != TRK_KEY && (buf[0] != TRK_DELTA || !s->count)) return -1;
+
+	trk_unpack(&s->prev, p);
+	for (i=0; i<TRK_FIELDS; i++) {
+		if (!(used = get_varint(buf + n, len - n, &z)))
+			return (len - n < 5) ? 0 : -1;
+		n += used;
+		v[i] = (buf[0] == TRK_KEY) ? z : p[i] + UNZIGZAG(z);
+	}
+
+	trk_pack(v, r);
+	s->prev = *r;
+	s->count = 1;
+
+	return n;
+}
+
+void trk_start(struct trk_state * s, struct fatwrite_t * fwrite)
+{
+	trk_init(s);
+
+	del(TRK_NAME);
+	touch(TRK_NAME);
+
+	write_start(TRK_NAME, fwrite);
+	write_add_P(fwrite, PSTR(TRK_MAGIC), sizeof(TRK_MAGIC)-1);
+	write_end(fwrite);
+}
+
+void trk_add(struct trk_state * s, struct fatwrite_t * fwrite, const struct trk_record * r)
+{
+	uint8_t buf[TRK_MAXREC];
+	uint8_t n = trk_encode(s, r, buf);
+
+	write_append(TRK_NAME, fwrite);
+	write_add(fwrite, (const char *)buf, n);
+	write_end(fwrite);
+}
@@ -0,0 +1,55 @@
+#ifndef TRKLOG_H
+#define TRKLOG_H
+
+#include <inttypes.h>
+#include "fat32.h"
+
+#define TRK_NAME "track.bin"
+#define TRK_MAGIC "TRK1"
+#define TRK_KEYEVERY 32		//absolute record this often so a damaged file can resync
+#define TRK_MAXREC 48		//longest encoded record
+#define TRK_NOPHOTO 0xffff
+
+/* record tags, a key record holds absolute values and a delta record
+ * the difference from the one before, every field as a varint
+ */
+#define TRK_KEY 'K'
+#define TRK_DELTA 'D'
+
+struct trk_record {
+	uint32_t time;		//seconds since 2000-01-01 UTC
+	int32_t lat;		//degrees * 1e7
+	int32_t lon;		//degrees * 1e7
+	uint16_t sog;		//speed over ground cm/s
+	uint16_t cog;		//course over ground degrees * 100
+	uint32_t dist;		//displacement from the start, centimeters
+	uint16_t bearing;	//initial bearing from the start, degrees * 100
+	uint16_t photo;		//photo number or TRK_NOPHOTO
+};
+
+/* encoder or decoder state, the previous record and where we are
+ * in the key record cycle
+ */
+struct trk_state {
+	struct trk_record prev;
+	uint8_t count;
+};
+
+void trk_init(struct trk_state * s);
+
+/* seconds since 2000 from NMEA ddmmyy and hhmmss.sss strings */
+uint32_t trk_time(const char * date, const char * time);
+
+/* encodes a record into buf (at least TRK_MAXREC bytes), returns its length */
+uint8_t trk_encode(struct trk_state * s, const struct trk_record * r, uint8_t * buf);
+
+/* decodes one record, returns the bytes used, 0 if buf ends mid record,
+ * or -1 if buf doesn't start with a record the state can decode
+ */
+int trk_decode(struct trk_state * s, const uint8_t * buf, int len, struct trk_record * r);
+
+/* create track.bin in the current directory and append records to it */
+void trk_start(struct trk_state * s, struct fatwrite_t * fwrite);
+void trk_add(struct trk_state * s, struct fatwrite_t * fwrite, const struct trk_record * r);
+
+#endif
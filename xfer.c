@@ -0,0 +1,244 @@
+//////////////////////////////////
+//Serial file transfer		//
+//framed, CRC checked blocks	//
+//for host/xfer			//
+//////////////////////////////////
+
+#include <inttypes.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include "serial.h"
+#include "sdcard.h"
+#include "fat32.h"
+#include "xfer.h"
+
+#define XFER_MAXREQ 16		// longest request payload
+#define XFER_BYTE_TIMEOUT 50	// ms between bytes of a frame
+#define XFER_ACK_TIMEOUT 1000	// ms to wait for A before sending the window again
+#define XFER_RETRIES 8
+#define XFER_IDLE 60000		// ms without a request before going back to the shell
+
+// rates at 8 MHz, the shell's own first
+struct xfer_rate {
+	unsigned int baud;	// hundreds
+	uint8_t ubrr;
+	uint8_t u2x;
+};
+static const struct xfer_rate xfer_rates[] PROGMEM = {
+	{96, 51, 0}, {192, 51, 1}, {384, 25, 1}, {576, 16, 1}, {5000, 1, 1}, {10000, 0, 1}
+};
+
+struct xfer_frame {
+	uint8_t type;
+	uint16_t block;
+	uint16_t len;
+	uint8_t data[XFER_MAXREQ];
+};
+
+static uint16_t xfer_crc;
+
+static void xfer_put(uint8_t c)
+{
+	send_char(c);
+	xfer_crc = _crc_xmodem_update(xfer_crc, c);
+}
+
+static void xfer_send(uint8_t type, uint16_t block, const uint8_t * p, uint16_t len)
+{
+	send_char(XFER_SOH);
+	xfer_crc = 0;
+	xfer_put(type);
+	xfer_put(block & 0xff);
+	xfer_put(block >> 8);
+	xfer_put(len & 0xff);
+	xfer_put(len >> 8);
+	while (len--) xfer_put(*p++);
+	send_char(xfer_crc & 0xff);
+	send_char(xfer_crc >> 8);
+}
+
+/* waits up to ms for a frame, returns its type, 0 on timeout or XFER_BAD */
+static uint8_t xfer_recv(struct xfer_frame * f, unsigned int ms)
+{
+	uint8_t hdr[7];
+	uint16_t crc = 0, i;
+	int c;
+
+	// anything before SOH is noise or the shell's echo
+	do {
+		if ((c = receive_char_timeout(ms)) < 0) return 0;
+	} while (c != XFER_SOH);
+
+	for (i=0; i<5; i++) {
+		if ((c = receive_char_timeout(XFER_BYTE_TIMEOUT)) < 0) return XFER_BAD;
+		hdr[i] = c;
+		crc = _crc_xmodem_update(crc, c);
+	}
+	f->type = hdr[0];
+	f->block = hdr[1] | (hdr[2] << 8);
+	f->len = hdr[3] | (hdr[4] << 8);
+	if (f->len > XFER_MAXREQ) return XFER_BAD;
+
+	for (i=0; i<f->len; i++) {
+		if ((c = receive_char_timeout(XFER_BYTE_TIMEOUT)) < 0) return XFER_BAD;
+		f->data[i] = c;
+		crc = _crc_xmodem_update(crc, c);
+	}
+	for (i=5; i<7; i++) {
+		if ((c = receive_char_timeout(XFER_BYTE_TIMEOUT)) < 0) return XFER_BAD;
+		hdr[i] = c;
+	}
+
+	return (hdr[5] | (hdr[6] << 8)) == crc ? f->type : XFER_BAD;
+}
+
+static char xfer_rate(unsigned int hundreds, struct xfer_rate * r)
+{
+	uint8_t i;
+
+	for (i=0; i<sizeof(xfer_rates)/sizeof(xfer_rates[0]); i++) {
+		memcpy_P(r, &xfer_rates[i], sizeof(*r));
+		if (r->baud == hundreds) return 0;
+	}
+
+	return 1;
+}
+
+char xfer_baud(unsigned int hundreds)
+{
+	struct xfer_rate r;
+
+	if (xfer_rate(hundreds, &r)) return 1;
+	send_flush();
+	serial_set_baud(r.ubrr, r.u2x);
+
+	return 0;
+}
+
+static uint32_t xfer_count;
+
+static char xfer_dirent(struct fat32dirent_t * de)
+{
+	uint8_t d[16];
+	uint8_t i;
+
+	if (de->type != DIRENT_FILE) return 0;
+	for (i=0; i<11; i++) d[i] = de->filename[i];
+	d[11] = de->attrib;
+	d[12] = de->size;
+	d[13] = de->size >> 8;
+	d[14] = de->size >> 16;
+	d[15] = de->size >> 24;
+	xfer_send('D', xfer_count++, d, sizeof(d));
+
+	return 0;
+}
+
+/* streams blocks from a file, or sectors from lba if fread is NULL */
+static void xfer_stream(struct fatread_t * fread, uint32_t lba, uint16_t blocks, uint32_t size, uint8_t * buf)
+{
+	struct xfer_frame f;
+	struct fatread_t win;	// where the window starts, a retry goes back there
+	uint16_t base = 0, next, at = 0;
+	uint8_t h[6], retries = 0;
+	int n;
+
+	h[0] = size;
+	h[1] = size >> 8;
+	h[2] = size >> 16;
+	h[3] = size >> 24;
+	h[4] = blocks;
+	h[5] = blocks >> 8;
+	xfer_send('H', 0, h, sizeof(h));
+	if (fread) win = *fread;
+
+	while (base < blocks) {
+		// the host may have missed it, it goes again with the first window
+		if (base == 0 && retries) xfer_send('H', 0, h, sizeof(h));
+
+		// one window, the host only answers once it's all out
+		for (next = base; next < blocks && next < base + XFER_WINDOW; next++) {
+			if (fread) {
+				if (at != next) {
+					*fread = win;
+					read_seek(fread, next);
+				}
+				if (next == base) win = *fread;
+				n = read_sector(fread, buf);
+				at = next + 1;
+			} else {
+				n = mmc_readsector(lba + next, buf) ? -1 : 512;
+			}
+			if (n < 0) {
+				xfer_send('X', next, 0, 0);
+				return;
+			}
+			xfer_send('B', next, buf, n);
+		}
+
+		// the host says where to carry on, a lost window just goes again
+		if (xfer_recv(&f, XFER_ACK_TIMEOUT) == 'A' && f.block >= base && f.block <= next) {
+			if (f.block == base && ++retries > XFER_RETRIES) return;
+			if (f.block != base) retries = 0;
+			base = f.block;
+		} else if (++retries > XFER_RETRIES) {
+			return;
+		}
+	}
+}
+
+void xfer_run(uint8_t * buf)
+{
+	struct xfer_frame f;
+	struct fatread_t fread;
+	struct xfer_rate r;
+	uint32_t lba;
+
+	while (1) {
+		switch (xfer_recv(&f, XFER_IDLE)) {
+		case 'L':
+			xfer_count = 0;
+			dir_each(xfer_dirent);
+			xfer_send('E', xfer_count, 0, 0);
+			break;
+
+		case 'F':
+			f.data[f.len < XFER_MAXREQ ? f.len : XFER_MAXREQ - 1] = '\0';
+			if (!read_start((const char *)f.data, &fread)) {
+				xfer_send('X', 0, 0, 0);
+				break;
+			}
+			xfer_stream(&fread, 0, (fread.size + 511) / 512, fread.size, buf);
+			break;
+
+		case 'S':
+			if (f.len < 4) {
+				xfer_send('X', 0, 0, 0);
+				break;
+			}
+			lba = f.data[0] | ((uint32_t)f.data[1] << 8) | ((uint32_t)f.data[2] << 16) | ((uint32_t)f.data[3] << 24);
+			xfer_stream(0, lba, f.block, f.block * 512UL, buf);
+			break;
+
+		case 'R':
+			// answer at the old rate, then change
+			if (xfer_rate(f.block, &r)) {
+				xfer_send('X', f.block, 0, 0);
+				break;
+			}
+			xfer_send('K', f.block, 0, 0);
+			send_flush();
+			serial_set_baud(r.ubrr, r.u2x);
+			break;
+
+		case 'Q':
+			xfer_send('K', 0, 0, 0);
+			return;
+
+		case 0:
+			// nothing for a long while, the host is gone
+			return;
+		}
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef XFER_H
+#define XFER_H
+
+#include <inttypes.h>
+
+/* framed binary transfers for host/xfer, every frame is
+ *   SOH, type, block (2), length (2), payload, CRC-16/XMODEM (2)
+ * little endian, the CRC covers type through payload
+ *
+ * host requests        device answers
+ *   L  list              D per entry (name 11, attrib, size 4), then E
+ *   F  file, name        H (size 4, blocks 2), then B blocks
+ *   S  sectors, lba 4,   H, then B blocks
+ *      count as block
+ *   R  baud / 100 as     K at the old rate, then switches
+ *      block
+ *   A  next block wanted after each window of blocks
+ *   Q  back to the shell
+ * blocks go out XFER_WINDOW at a time, then the device waits for A
+ * with the block the host wants next and carries on from there, the
+ * host asks again if the H doesn't come and H is resent with block 0
+ */
+
+#define XFER_SOH 0x01
+#define XFER_BAD 0xff		//xfer_recv() got a damaged frame
+#define XFER_WINDOW 8
+
+/* runs until the host quits, buf is a 512 byte sector buffer */
+void xfer_run(uint8_t * buf);
+
+/* switches the shell's baud, returns 0 or 1 for a rate we can't do */
+char xfer_baud(unsigned int hundreds);
+
+#endif